@@ -24,13 +24,121 @@
 #include "common/log.hh"
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <array>
 #include <list>
 #include <stdexcept>
 #include <unordered_map>
 
+#ifdef _WIN32
+#include <windows.h>
+
+// don't break std::min
+#ifdef min
+#undef min
+#endif
+#ifdef max
+#undef max
+#endif
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace fs
 {
+/*
+ * A read-only view of a whole file, memory mapped where the OS allows it
+ * and read into memory otherwise. Archives map their file once; loads then
+ * copy out of the view, so they need no locking.
+ */
+class mapped_file
+{
+    const uint8_t *base = nullptr;
+    size_t length = 0;
+    std::vector<uint8_t> fallback;
+
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    explicit mapped_file(const path &p)
+    {
+        length = file_size(p);
+
+        if (!length) {
+            return;
+        }
+
+#ifdef _WIN32
+        HANDLE file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file != INVALID_HANDLE_VALUE) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(file);
+
+            if (mapping) {
+                base = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+#else
+        int fd = open(p.c_str(), O_RDONLY);
+
+        if (fd != -1) {
+            void *view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if (view != MAP_FAILED) {
+                base = static_cast<const uint8_t *>(view);
+            }
+        }
+#endif
+
+        if (!base) {
+            std::ifstream stream(p, std::ios_base::in | std::ios_base::binary);
+            fallback.resize(length);
+            if (!stream.read(reinterpret_cast<char *>(fallback.data()), length)) {
+                throw std::runtime_error("Unable to read file");
+            }
+            base = fallback.data();
+        }
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file()
+    {
+        if (!base || base == fallback.data()) {
+            return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+        CloseHandle(mapping);
+#else
+        munmap(const_cast<uint8_t *>(base), length);
+#endif
+    }
+
+    const uint8_t *data() const { return base; }
+    size_t size() const { return length; }
+
+    // copies out [offset, offset + size), or nullopt if that's past the end of the file
+    fs::data copy(size_t offset, size_t size) const
+    {
+        if (offset > length || size > length - offset) {
+            return std::nullopt;
+        }
+
+        return std::vector<uint8_t>(base + offset, base + offset + size);
+    }
+};
+
 struct directory_archive : archive_like
 {
     using archive_like::archive_like;
@@ -58,7 +166,7 @@ struct directory_archive : archive_like
 
 struct pak_archive : archive_like
 {
-    std::ifstream pakstream;
+    mapped_file pakfile;
 
     struct pak_header
     {
@@ -81,9 +189,9 @@ struct pak_archive : archive_like
     std::unordered_map<std::string, std::tuple<uint32_t, uint32_t>, case_insensitive_hash, case_insensitive_equal>
         files;
 
-    inline pak_archive(const path &pathname, bool external)
-        : archive_like(pathname, external), pakstream(pathname, std::ios_base::in | std::ios_base::binary)
+    inline pak_archive(const path &pathname, bool external) : archive_like(pathname, external), pakfile(pathname)
     {
+        imemstream pakstream(pakfile.data(), pakfile.size());
         pakstream >> endianness<std::endian::little>;
 
         pak_header header;
@@ -119,17 +227,13 @@ struct pak_archive : archive_like
             return std::nullopt;
         }
 
-        pakstream.seekg(std::get<0>(it->second));
-        uintmax_t size = std::get<1>(it->second);
-        std::vector<uint8_t> data(size);
-        pakstream.read(reinterpret_cast<char *>(data.data()), size);
-        return data;
+        return pakfile.copy(std::get<0>(it->second), std::get<1>(it->second));
     }
 };
 
 struct wad_archive : archive_like
 {
-    std::ifstream wadstream;
+    mapped_file wadfile;
 
     // WAD Format
     struct wad_header
@@ -160,9 +264,9 @@ struct wad_archive : archive_like
     std::unordered_map<std::string, std::tuple<uint32_t, uint32_t>, case_insensitive_hash, case_insensitive_equal>
         files;
 
-    inline wad_archive(const path &pathname, bool external)
-        : archive_like(pathname, external), wadstream(pathname, std::ios_base::in | std::ios_base::binary)
+    inline wad_archive(const path &pathname, bool external) : archive_like(pathname, external), wadfile(pathname)
     {
+        imemstream wadstream(wadfile.data(), wadfile.size());
         wadstream >> endianness<std::endian::little>;
 
         wad_header header;
@@ -196,20 +300,22 @@ struct wad_archive : archive_like
             return std::nullopt;
         }
 
-        wadstream.seekg(std::get<0>(it->second));
-        uintmax_t size = std::get<1>(it->second);
-        std::vector<uint8_t> data(size);
-        wadstream.read(reinterpret_cast<char *>(data.data()), size);
-        return data;
+        return wadfile.copy(std::get<0>(it->second), std::get<1>(it->second));
     }
 };
 
 static std::shared_ptr<directory_archive> absrel_dir = std::make_shared<directory_archive>("", false);
 std::list<std::shared_ptr<archive_like>> archives, directories;
 
+// guards `archives` and `directories`; archives themselves are immutable once
+// added, so loading from a resolved archive doesn't take it
+static std::recursive_mutex archives_lock;
+
 /** It's possible to compile quake 1/hexen 2 maps without a qdir */
 void clear()
 {
+    std::unique_lock lock(archives_lock);
+
     archives.clear();
     directories.clear();
 }
@@ -259,6 +365,8 @@ inline std::shared_ptr<archive_like> addArchiveInternal(const path &p, bool exte
 
 std::shared_ptr<archive_like> addArchive(const path &p, bool external)
 {
+    std::unique_lock lock(archives_lock);
+
     if (p.empty()) {
         logging::funcprint("WARNING: can't add empty archive path\n");
         return nullptr;
@@ -281,6 +389,8 @@ std::shared_ptr<archive_like> addArchive(const path &p, bool external)
 
 resolve_result where(const path &p, bool prefer_loose)
 {
+    std::unique_lock lock(archives_lock);
+
     // check direct archive loading first; it can't ever
     // be loose, so there's no sense for it to be in the
     // loop below
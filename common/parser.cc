@@ -24,6 +24,8 @@
 #include <common/log.hh>
 #include <common/parser.hh>
 
+#include <charconv>
+
 // parser_source_location
 
 parser_source_location::parser_source_location() = default;
@@ -57,11 +59,15 @@ parser_t::parser_t(const char *str, parser_source_location base_location) : pars
 
 bool parser_t::parse_token(parseflags flags)
 {
-    /* for peek, we'll do a backup/restore. */
+    /* for peek, we'll do a backup/restore. only the position and line
+       can change while parsing a token, so save those rather than the
+       whole location. */
     if (flags & PARSE_PEEK) {
-        auto restore = untie(state());
+        const char *restore_pos = pos;
+        const std::optional<size_t> restore_line = location.line_number;
         bool result = parse_token(flags & ~PARSE_PEEK);
-        state() = restore;
+        pos = restore_pos;
+        location.line_number = restore_line;
         return result;
     }
 
@@ -165,15 +171,71 @@ skipspace:
         }
         pos++;
     } else {
+        const char *start = pos;
         while (*pos > 32) {
-            *token_p++ = *pos++;
+            pos++;
         }
+        token.assign(start, pos);
     }
 
 out:
     return true;
 }
 
+bool parser_t::skip_block()
+{
+    int depth = 1;
+
+    while (!at_end() && *pos) {
+        /* skip space */
+        if (*pos <= 32) {
+            if (*pos == '\n')
+                location.line_number.value()++;
+            pos++;
+            continue;
+        }
+
+        /* comment field */
+        if ((pos[0] == '/' && pos[1] == '/') || pos[0] == ';') {
+            while (!at_end() && *pos && *pos != '\n') {
+                pos++;
+            }
+            continue;
+        }
+
+        /* quoted token; step over escapes the same way parse_token does */
+        if (*pos == '"') {
+            pos++;
+            while (*pos != '"') {
+                if (at_end() || !*pos)
+                    FError("{}: EOF inside quoted token", location);
+                if (pos[0] == '\\' && pos[1] && !(pos[1] == '"' && (pos[2] == '\r' || pos[2] == '\n'))) {
+                    pos++;
+                }
+                pos++;
+            }
+            pos++;
+            continue;
+        }
+
+        /* only a brace on its own is a token; "{fence" is a texture name */
+        const char *start = pos;
+        while (*pos > 32) {
+            pos++;
+        }
+
+        if (pos - start == 1) {
+            if (*start == '{') {
+                depth++;
+            } else if (*start == '}' && !--depth) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 parser_t::state_type parser_t::state() { return state_type(pos, location); }
 
 bool parser_t::at_end() const { return pos >= end; }
@@ -189,6 +251,47 @@ void parser_t::pop_state()
     _states.pop_back();
 }
 
+// number parsing
+
+double parse_double(std::string_view str)
+{
+    std::string_view digits = str;
+
+    // from_chars doesn't take a leading +, which stod does
+    if (!digits.empty() && digits.front() == '+') {
+        digits.remove_prefix(1);
+    }
+
+    double value;
+    auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+
+    // anything from_chars doesn't fully consume (hex, stray characters, out of range)
+    // goes through stod, so the result and errors are the same as before
+    if (ec != std::errc() || ptr != digits.data() + digits.size()) {
+        return std::stod(std::string(str));
+    }
+
+    return value;
+}
+
+int32_t parse_int(std::string_view str)
+{
+    std::string_view digits = str;
+
+    if (!digits.empty() && digits.front() == '+') {
+        digits.remove_prefix(1);
+    }
+
+    int32_t value;
+    auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+
+    if (ec != std::errc() || ptr != digits.data() + digits.size()) {
+        return std::stoi(std::string(str));
+    }
+
+    return value;
+}
+
 // token_parser_t
 
 token_parser_t::token_parser_t(int argc, const char **args, parser_source_location base_location) : parser_base_t(base_location), tokens(args, args + argc) { }
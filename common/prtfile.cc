@@ -23,27 +23,227 @@
 #include <common/fs.hh>
 #include <common/bspfile.hh>
 
+#include <bit>
 #include <fstream>
+#include <mutex>
+#include <optional>
 
 constexpr const char *PORTALFILE = "PRT1";
 constexpr const char *PORTALFILE2 = "PRT2";
 constexpr const char *PORTALFILEAM = "PRT1-AM";
+constexpr const char *PORTALFILEBINARY = "PRTBIN1";
 
 constexpr size_t PRT_MAX_WINDING = 64;
 
+/*
+ * Binary portal file: the PRTBIN1 line, then (all little endian)
+ *
+ *   prtbin_header_t
+ *   prtbin_portal_t[numportals]
+ *   qvec3d[numpoints]             the winding points of all portals, in order
+ *   int32_t[numleafinfos]         cluster of each leaf (prtfile_t::dleafinfos)
+ */
+struct prtbin_header_t
+{
+    int32_t portalleafs;
+    int32_t portalleafs_real;
+    uint32_t numportals;
+    uint32_t numpoints;
+    uint32_t numleafinfos;
+};
+
+struct prtbin_portal_t
+{
+    int32_t leafnums[2];
+    uint32_t numpoints;
+};
+
+static_assert(sizeof(qvec3d) == sizeof(double) * 3);
+
+template<typename T>
+static void SwapLittleEndian(T *values, size_t count)
+{
+    if constexpr (std::endian::native != std::endian::little) {
+        static_assert(sizeof(T) % sizeof(uint32_t) == 0 || sizeof(T) % sizeof(double) == 0);
+        constexpr size_t word = (sizeof(T) % sizeof(double) == 0 && alignof(T) == alignof(double)) ? 8 : 4;
+        auto bytes = reinterpret_cast<uint8_t *>(values);
+
+        for (size_t i = 0; i < sizeof(T) * count; i += word) {
+            std::reverse(bytes + i, bytes + i + word);
+        }
+    }
+}
+
+template<typename T>
+static void ReadBinaryArray(std::istream &f, std::vector<T> &values, size_t count, const fs::path &name)
+{
+    values.resize(count);
+    f.read(reinterpret_cast<char *>(values.data()), sizeof(T) * count);
+
+    if (!f) {
+        FError("unexpected end of binary portal file {}", name);
+    }
+
+    SwapLittleEndian(values.data(), count);
+}
+
+template<typename T>
+static void WriteBinaryArray(std::ostream &f, std::vector<T> values)
+{
+    SwapLittleEndian(values.data(), values.size());
+    f.write(reinterpret_cast<const char *>(values.data()), sizeof(T) * values.size());
+}
+
+/*
+ * The binary and in-memory formats carry any prtfile_t; make sure it has the
+ * shape the text formats are limited to for this game.
+ */
+static void CheckPrtFileForGame(const prtfile_t &prtfile, const fs::path &name, const bspversion_t *loadversion)
+{
+    if (loadversion->game->id == GAME_QUAKE_II) {
+        // Q2 has native clusters; same as the PRT2/PRT1-AM check for text files
+        if (prtfile.portalleafs_real != 0 || !prtfile.dleafinfos.empty()) {
+            FError("{} has a leaf->cluster map and can not be used with Q2\n", name);
+        }
+    } else if (prtfile.dleafinfos.size() != static_cast<size_t>(prtfile.portalleafs_real) + 1) {
+        FError("{} has no leaf->cluster map for its {} leafs\n", name, prtfile.portalleafs_real);
+    }
+}
+
+static prtfile_t LoadBinaryPrtFile(std::istream &f, const fs::path &name, const bspversion_t *loadversion)
+{
+    std::vector<prtbin_header_t> header;
+    ReadBinaryArray(f, header, 1, name);
+
+    prtfile_t result{};
+    result.portalleafs = header[0].portalleafs;
+    result.portalleafs_real = header[0].portalleafs_real;
+
+    std::vector<prtbin_portal_t> portals;
+    std::vector<qvec3d> points;
+    std::vector<int32_t> clusters;
+    ReadBinaryArray(f, portals, header[0].numportals, name);
+    ReadBinaryArray(f, points, header[0].numpoints, name);
+    ReadBinaryArray(f, clusters, header[0].numleafinfos, name);
+
+    result.portals.resize(portals.size());
+
+    size_t firstpoint = 0;
+
+    for (size_t i = 0; i < portals.size(); i++) {
+        const prtbin_portal_t &src = portals[i];
+        prtfile_portal_t &p = result.portals[i];
+
+        if (src.numpoints > PRT_MAX_WINDING)
+            FError("portal {} has too many points", i);
+        if (src.numpoints > points.size() - firstpoint)
+            FError("portal {} points out of bounds", i);
+        if ((unsigned)src.leafnums[0] > (unsigned)result.portalleafs ||
+            (unsigned)src.leafnums[1] > (unsigned)result.portalleafs)
+            FError("out of bounds leaf in portal {}", i);
+
+        p.leafnums[0] = src.leafnums[0];
+        p.leafnums[1] = src.leafnums[1];
+        p.winding = prtfile_winding_t(points.begin() + firstpoint, points.begin() + firstpoint + src.numpoints);
+        firstpoint += src.numpoints;
+    }
+
+    result.dleafinfos.resize(clusters.size());
+
+    for (size_t i = 0; i < clusters.size(); i++) {
+        if (i > 0 && (clusters[i] < 0 || clusters[i] >= result.portalleafs))
+            FError("Invalid cluster number {} in cluster map, number of clusters: {}\n", clusters[i],
+                result.portalleafs);
+        result.dleafinfos[i].cluster = clusters[i];
+    }
+
+    CheckPrtFileForGame(result, name, loadversion);
+
+    return result;
+}
+
+void WriteBinaryPrtFile(const fs::path &name, const prtfile_t &prtfile)
+{
+    std::ofstream f(name, std::ios_base::out | std::ios_base::binary);
+    if (!f)
+        FError("Failed to open {}: {}", name, strerror(errno));
+
+    f << PORTALFILEBINARY << '\n';
+
+    std::vector<prtbin_portal_t> portals;
+    std::vector<qvec3d> points;
+    std::vector<int32_t> clusters;
+
+    portals.reserve(prtfile.portals.size());
+
+    for (auto &p : prtfile.portals) {
+        portals.push_back({{p.leafnums[0], p.leafnums[1]}, static_cast<uint32_t>(p.winding.size())});
+        points.insert(points.end(), p.winding.begin(), p.winding.end());
+    }
+
+    for (auto &info : prtfile.dleafinfos) {
+        clusters.push_back(info.cluster);
+    }
+
+    WriteBinaryArray(f, std::vector<prtbin_header_t>{{prtfile.portalleafs, prtfile.portalleafs_real,
+                            static_cast<uint32_t>(portals.size()), static_cast<uint32_t>(points.size()),
+                            static_cast<uint32_t>(clusters.size())}});
+    WriteBinaryArray(f, std::move(portals));
+    WriteBinaryArray(f, std::move(points));
+    WriteBinaryArray(f, std::move(clusters));
+}
+
+static std::mutex prtfile_memory_lock;
+static std::optional<std::pair<fs::path, prtfile_t>> prtfile_memory;
+
+static fs::path PrtFileMemoryKey(const fs::path &name)
+{
+    return fs::absolute(name).lexically_normal();
+}
+
+void StorePrtFileInMemory(const fs::path &name, prtfile_t prtfile)
+{
+    std::unique_lock lock(prtfile_memory_lock);
+    prtfile_memory = std::make_pair(PrtFileMemoryKey(name), std::move(prtfile));
+}
+
+void ClearPrtFileInMemory()
+{
+    std::unique_lock lock(prtfile_memory_lock);
+    prtfile_memory.reset();
+}
+
 prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
 {
-    std::ifstream f(name);
+    {
+        std::unique_lock lock(prtfile_memory_lock);
+
+        if (prtfile_memory && prtfile_memory->first == PrtFileMemoryKey(name)) {
+            prtfile_t result = std::move(prtfile_memory->second);
+            prtfile_memory.reset();
+            CheckPrtFileForGame(result, name, loadversion);
+            return result;
+        }
+    }
+
+    std::ifstream f(name, std::ios_base::in | std::ios_base::binary);
 
     /*
      * Parse the portal file header
      */
     std::string magic;
     std::getline(f, magic);
+    if (!magic.empty() && magic.back() == '\r') {
+        magic.pop_back();
+    }
     if (magic.empty()) {
         FError("unknown header/empty portal file {}\n", name);
     }
 
+    if (magic == PORTALFILEBINARY) {
+        return LoadBinaryPrtFile(f, name, loadversion);
+    }
+
     prtfile_t result{};
     int numportals;
 
@@ -207,6 +207,11 @@ public:
         return s[0] * s[1] * s[2];
     }
 
+    constexpr V surface_area() const {
+        auto s = size();
+        return 2 * (s[0] * s[1] + s[1] * s[2] + s[2] * s[0]);
+    }
+
     constexpr auto begin() { return m_corners.begin(); }
     constexpr auto end() { return m_corners.end(); }
 
@@ -159,6 +159,11 @@ struct parser_t : parser_base_t
 
     bool parse_token(parseflags flags = PARSE_NORMAL) override;
 
+    // skip to just past the } that closes a block whose { was the last
+    // token parsed, without copying any tokens. nested blocks are skipped
+    // too. returns false if EOF was hit first.
+    bool skip_block();
+
     using state_type = decltype(std::tie(pos, location));
 
     state_type state();
@@ -173,6 +178,12 @@ public:
     void pop_state() override;
 };
 
+// convert a token to a number; same results as std::stod/std::stoi
+// (including the exceptions thrown on bad input), but the common case
+// goes through std::from_chars
+double parse_double(std::string_view str);
+int32_t parse_int(std::string_view str);
+
 // a parser that works on a list of tokens
 struct token_parser_t : parser_base_t
 {
@@ -0,0 +1,228 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <common/mathlib.hh>
+#include <common/qvec.hh>
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// the result of classifying a run of points against one plane
+struct point_sides_t
+{
+    std::array<size_t, SIDE_TOTAL> counts{};
+
+    // bit `i` is set if point `i` is on that side; only the first
+    // 64 points are recorded
+    uint64_t front_mask = 0;
+    uint64_t back_mask = 0;
+
+    // the furthest distance in front of the plane (>= 0), and the
+    // furthest behind it (<= 0)
+    vec_t max_front = 0;
+    vec_t max_back = 0;
+};
+
+namespace qv
+{
+namespace detail
+{
+inline void accumulate_side(point_sides_t &result, size_t i, vec_t d, vec_t on_epsilon, planeside_t *sides)
+{
+    planeside_t side;
+
+    if (d > on_epsilon)
+        side = SIDE_FRONT;
+    else if (d < -on_epsilon)
+        side = SIDE_BACK;
+    else
+        side = SIDE_ON;
+
+    result.counts[side]++;
+
+    if (i < 64) {
+        if (side == SIDE_FRONT)
+            result.front_mask |= uint64_t(1) << i;
+        else if (side == SIDE_BACK)
+            result.back_mask |= uint64_t(1) << i;
+    }
+
+    if (d > result.max_front)
+        result.max_front = d;
+    if (d < result.max_back)
+        result.max_back = d;
+
+    if (sides) {
+        sides[i] = side;
+    }
+}
+
+// classifies a block of `N` distances whose front/back comparisons are in the
+// low bits of `front_bits`/`back_bits`
+template<size_t N>
+inline void accumulate_block(point_sides_t &result, size_t i, int front_bits, int back_bits, planeside_t *sides)
+{
+    result.counts[SIDE_FRONT] += std::popcount(static_cast<unsigned>(front_bits));
+    result.counts[SIDE_BACK] += std::popcount(static_cast<unsigned>(back_bits));
+    result.counts[SIDE_ON] += N - std::popcount(static_cast<unsigned>(front_bits | back_bits));
+
+    if (i < 64) {
+        result.front_mask |= uint64_t(front_bits) << i;
+        result.back_mask |= uint64_t(back_bits) << i;
+    }
+
+    if (sides) {
+        for (size_t j = 0; j < N; j++) {
+            sides[i + j] = (front_bits & (1 << j)) ? SIDE_FRONT : (back_bits & (1 << j)) ? SIDE_BACK : SIDE_ON;
+        }
+    }
+}
+} // namespace detail
+
+/*
+==================
+classify_points
+
+Computes the distance of `count` points to `plane` and classifies them with
+`on_epsilon`, the same way as a loop over plane.distance_to() would: the
+distances are bit-identical to the scalar ones (the sum is done in the same
+order, without fused multiply-adds).
+
+`dists` and `sides`, if not null, must have room for `count` entries.
+
+Uses AVX2 (4 points at a time) or SSE2 (2 points) when the compiler targets
+them, with a scalar loop for the remainder.
+==================
+*/
+inline point_sides_t classify_points(const qvec3d *points, size_t count, const qplane3d &plane,
+    vec_t on_epsilon, vec_t *dists = nullptr, planeside_t *sides = nullptr)
+{
+    static_assert(sizeof(qvec3d) == sizeof(double) * 3, "classify_points needs tightly packed points");
+
+    point_sides_t result;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    if (count >= 4) {
+        const __m256d nx = _mm256_set1_pd(plane.normal[0]);
+        const __m256d ny = _mm256_set1_pd(plane.normal[1]);
+        const __m256d nz = _mm256_set1_pd(plane.normal[2]);
+        const __m256d pd = _mm256_set1_pd(plane.dist);
+        const __m256d front_eps = _mm256_set1_pd(on_epsilon);
+        const __m256d back_eps = _mm256_set1_pd(-on_epsilon);
+        const __m128i stride = _mm_setr_epi32(0, 3, 6, 9);
+
+        __m256d max_front = _mm256_setzero_pd();
+        __m256d max_back = _mm256_setzero_pd();
+
+        for (; i + 4 <= count; i += 4) {
+            const double *p = &points[i][0];
+            const __m256d x = _mm256_i32gather_pd(p, stride, 8);
+            const __m256d y = _mm256_i32gather_pd(p + 1, stride, 8);
+            const __m256d z = _mm256_i32gather_pd(p + 2, stride, 8);
+
+            // same order as qv::dot: ((0 + x*nx) + y*ny) + z*nz
+            __m256d d = _mm256_add_pd(_mm256_setzero_pd(), _mm256_mul_pd(x, nx));
+            d = _mm256_add_pd(d, _mm256_mul_pd(y, ny));
+            d = _mm256_add_pd(d, _mm256_mul_pd(z, nz));
+            d = _mm256_sub_pd(d, pd);
+
+            if (dists) {
+                _mm256_storeu_pd(dists + i, d);
+            }
+
+            // max/min return the second operand for NaN, like the scalar compares
+            max_front = _mm256_max_pd(d, max_front);
+            max_back = _mm256_min_pd(d, max_back);
+
+            detail::accumulate_block<4>(result, i, _mm256_movemask_pd(_mm256_cmp_pd(d, front_eps, _CMP_GT_OQ)),
+                _mm256_movemask_pd(_mm256_cmp_pd(d, back_eps, _CMP_LT_OQ)), sides);
+        }
+
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, max_front);
+        for (double v : lanes)
+            result.max_front = std::max(result.max_front, v);
+        _mm256_store_pd(lanes, max_back);
+        for (double v : lanes)
+            result.max_back = std::min(result.max_back, v);
+    }
+#elif defined(__SSE2__)
+    if (count >= 2) {
+        const __m128d nx = _mm_set1_pd(plane.normal[0]);
+        const __m128d ny = _mm_set1_pd(plane.normal[1]);
+        const __m128d nz = _mm_set1_pd(plane.normal[2]);
+        const __m128d pd = _mm_set1_pd(plane.dist);
+        const __m128d front_eps = _mm_set1_pd(on_epsilon);
+        const __m128d back_eps = _mm_set1_pd(-on_epsilon);
+
+        __m128d max_front = _mm_setzero_pd();
+        __m128d max_back = _mm_setzero_pd();
+
+        for (; i + 2 <= count; i += 2) {
+            const double *p = &points[i][0];
+            const __m128d x = _mm_setr_pd(p[0], p[3]);
+            const __m128d y = _mm_setr_pd(p[1], p[4]);
+            const __m128d z = _mm_setr_pd(p[2], p[5]);
+
+            // same order as qv::dot: ((0 + x*nx) + y*ny) + z*nz
+            __m128d d = _mm_add_pd(_mm_setzero_pd(), _mm_mul_pd(x, nx));
+            d = _mm_add_pd(d, _mm_mul_pd(y, ny));
+            d = _mm_add_pd(d, _mm_mul_pd(z, nz));
+            d = _mm_sub_pd(d, pd);
+
+            if (dists) {
+                _mm_storeu_pd(dists + i, d);
+            }
+
+            // max/min return the second operand for NaN, like the scalar compares
+            max_front = _mm_max_pd(d, max_front);
+            max_back = _mm_min_pd(d, max_back);
+
+            detail::accumulate_block<2>(result, i, _mm_movemask_pd(_mm_cmpgt_pd(d, front_eps)),
+                _mm_movemask_pd(_mm_cmplt_pd(d, back_eps)), sides);
+        }
+
+        alignas(16) double lanes[2];
+        _mm_store_pd(lanes, max_front);
+        result.max_front = std::max({result.max_front, lanes[0], lanes[1]});
+        _mm_store_pd(lanes, max_back);
+        result.max_back = std::min({result.max_back, lanes[0], lanes[1]});
+    }
+#endif
+
+    for (; i < count; i++) {
+        const vec_t d = plane.distance_to(points[i]);
+
+        if (dists) {
+            dists[i] = d;
+        }
+
+        detail::accumulate_side(result, i, d, on_epsilon, sides);
+    }
+
+    return result;
+}
+} // namespace qv
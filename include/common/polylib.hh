@@ -8,6 +8,7 @@
 #include <common/bspfile.hh>
 #include <common/cmdlib.hh>
 #include <common/aabb.hh>
+#include <common/planeside.hh>
 #include <variant>
 #include <array>
 #include <vector>
@@ -15,6 +16,7 @@
 #include <type_traits>
 #include <stdexcept>
 #include <optional>
+#include <utility>
 
 #include <tbb/scalable_allocator.h>
 
@@ -115,6 +117,12 @@ public:
 
     inline size_t size() const { return count; }
 
+    // the points as contiguous runs, see winding_storage_hybrid_t::point_runs
+    inline std::array<std::pair<const qvec3d *, size_t>, 2> point_runs() const
+    {
+        return {{{array.data(), count}, {nullptr, 0}}};
+    }
+
     inline qvec3d &at(const size_t &index)
     {
 #ifdef _DEBUG
@@ -258,6 +266,12 @@ public:
 
     inline size_t size() const { return values.size(); }
 
+    // the points as contiguous runs, see winding_storage_hybrid_t::point_runs
+    inline std::array<std::pair<const qvec3d *, size_t>, 2> point_runs() const
+    {
+        return {{{values.data(), values.size()}, {nullptr, 0}}};
+    }
+
     inline qvec3d &at(const size_t &index)
     {
         return values[index];
@@ -519,6 +533,12 @@ public:
 
     inline size_t size() const { return count; }
 
+    // the points as (up to) two contiguous runs: the array, then the vector
+    inline std::array<std::pair<const qvec3d *, size_t>, 2> point_runs() const
+    {
+        return {{{array.data(), min(count, N)}, {vector.data(), count > N ? count - N : 0}}};
+    }
+
     inline size_t vector_size() const { return vector.size(); }
 
     inline qvec3d &at(const size_t &index)
@@ -948,37 +968,52 @@ public:
         return result;
     }
 
-    // dists/sides can be null, or must have (size() + 1) reserved
-    inline std::array<size_t, SIDE_TOTAL> calc_sides(
+    /*
+    ==================
+    classify
+
+    Runs qv::classify_points over the storage's contiguous runs of points.
+    dists/sides can be null, or must have size() reserved.
+    ==================
+    */
+    inline point_sides_t classify(
         const qplane3d &plane, vec_t *dists, planeside_t *sides, const vec_t &on_epsilon = DEFAULT_ON_EPSILON) const
     {
-        std::array<size_t, SIDE_TOTAL> counts{};
+        point_sides_t result;
+        size_t offset = 0;
 
-        /* determine sides for each point */
-        size_t i;
+        for (auto &[points, count] : storage.point_runs()) {
+            if (!count) {
+                continue;
+            }
 
-        for (i = 0; i < size(); i++) {
-            vec_t dot = plane.distance_to(at(i));
+            point_sides_t run = qv::classify_points(
+                points, count, plane, on_epsilon, dists ? dists + offset : nullptr, sides ? sides + offset : nullptr);
 
-            if (dists) {
-                dists[i] = dot;
+            for (size_t s = 0; s < SIDE_TOTAL; s++) {
+                result.counts[s] += run.counts[s];
             }
 
-            planeside_t side;
+            if (offset < 64) {
+                result.front_mask |= run.front_mask << offset;
+                result.back_mask |= run.back_mask << offset;
+            }
 
-            if (dot > on_epsilon)
-                side = SIDE_FRONT;
-            else if (dot < -on_epsilon)
-                side = SIDE_BACK;
-            else
-                side = SIDE_ON;
+            result.max_front = std::max(result.max_front, run.max_front);
+            result.max_back = std::min(result.max_back, run.max_back);
+            offset += count;
+        }
 
-            counts[side]++;
+        return result;
+    }
 
-            if (sides) {
-                sides[i] = side;
-            }
-        }
+    // dists/sides can be null, or must have (size() + 1) reserved
+    inline std::array<size_t, SIDE_TOTAL> calc_sides(
+        const qplane3d &plane, vec_t *dists, planeside_t *sides, const vec_t &on_epsilon = DEFAULT_ON_EPSILON) const
+    {
+        /* determine sides for each point */
+        std::array<size_t, SIDE_TOTAL> counts = classify(plane, dists, sides, on_epsilon).counts;
+        size_t i = size();
 
         if (sides) {
             sides[i] = sides[SIDE_FRONT];
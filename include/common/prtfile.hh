@@ -50,3 +50,13 @@ struct prtfile_t
 
 struct bspversion_t;
 prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion);
+
+// writes `prtfile` in the binary format LoadPrtFile also reads: the same
+// contents as a PRT1/PRT2 file, but with exact doubles and bulk arrays
+void WriteBinaryPrtFile(const fs::path &name, const prtfile_t &prtfile);
+
+// in-memory handoff for a process that runs qbsp and then vis: qbsp stores
+// the portal file it would have written to `name`, and the next LoadPrtFile
+// of `name` takes it instead of reading the disk.
+void StorePrtFileInMemory(const fs::path &name, prtfile_t prtfile);
+void ClearPrtFileInMemory();
@@ -34,4 +34,5 @@
 
 void ResetBounce();
 const std::vector<surfacelight_t> &BounceLights();
+const surfacelight_tree_t &BounceLightTree();
 void MakeBounceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
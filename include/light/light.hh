@@ -129,9 +129,12 @@ struct lightsurf_t
 
     /*
      pvs for the entire light surface. generated by ORing together
-     the pvs at each of the sample points
+     the pvs at each of the sample points. null if there's no vis data;
+     points into the shared leaf pvs cache when all the points see the
+     same pvs, otherwise into merged_pvs
      */
-    std::vector<uint8_t> pvs;
+    const uint8_t *pvs = nullptr;
+    std::vector<uint8_t> merged_pvs;
 
     // output width * extra
     int width;
@@ -279,6 +282,7 @@ public:
     setting_scalar dirtScale;
     setting_scalar dirtGain;
     setting_scalar dirtAngle;
+    setting_scalar dirtAdaptive;
     setting_bool minlightDirt;
 
     /* phong */
@@ -354,6 +358,7 @@ public:
 
     setting_bool surflight_dump;
     setting_scalar surflight_subdivide;
+    setting_scalar surflight_error;
     setting_bool onlyents;
     setting_bool write_normals;
     setting_bool novanilla;
@@ -383,6 +388,7 @@ public:
     setting_int32 facestyles;
     setting_bool exportobj;
     setting_int32 lmshift;
+    setting_bool deterministic;
 
     setting_func dirtdebug;
     setting_func bouncedebug;
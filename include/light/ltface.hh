@@ -32,6 +32,7 @@
 #include <light/entities.hh>
 
 #include <vector>
+#include <functional>
 #include <map>
 #include <string>
 #include <cassert>
@@ -54,6 +55,8 @@ float DirtAtPoint(const settings::worldspawn_keys &cfg, raystream_intersection_t
     const qvec3d &normal, const modelinfo_t *selfshadow);
 std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const facesup_t *facesup,
     const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg);
+// must be called before CreateLightmapSurface; shares decompressed leaf pvs between surfaces
+void SetupLeafPvsCache(const mbsp_t *bsp);
 bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face);
 void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
 void IndirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
@@ -61,4 +64,25 @@ void FinishLightmapSurface(const mbsp_t *bsp, lightsurf_t *lightsurf);
 void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     bspx_decoupled_lm_perface *facesup_decoupled, lightsurf_t *lightsurf, const faceextents_t &extents,
     const faceextents_t &output_extents);
+
+// lightmap post-filters used by SaveLightmapSurface, on w*h images whose alpha
+// is 0 for occluded samples and 1 otherwise
+void HighlightSeams(std::vector<qvec4f> &image);
+void FloodFillTransparent(std::vector<qvec4f> &image, int w, int h);
+void BoxBlurImage(const std::vector<qvec4f> &input, std::vector<qvec4f> &output, int w, int h, int radius);
+void IntegerDownsampleImage(const std::vector<qvec4f> &input, std::vector<qvec4f> &output, int w, int h, int factor);
+
+// with _dirtadaptive, the share of the dirt vectors traced at every sample (1 in N);
+// coprime to the number of elevation steps so the subset covers every elevation
+constexpr int DIRT_ADAPTIVE_STRIDE = 4;
+
+// turns the summed hit distances of a face's dirt vectors into occlusion, for
+// a width*height grid of samples. `trace(j, only)` adds dirt vector j's hit
+// distance to `occlusion` at every unoccluded sample, or only those flagged in
+// `only`. With a nonzero threshold (_dirtadaptive), every vector is only traced
+// at the samples flagged in `refine`; the rest get a coarse subset.
+void CalculateDirtOcclusion(std::vector<float> &occlusion, std::vector<uint8_t> &refine,
+    const std::vector<bool> &occluded, int width, int height, int num_vectors, vec_t depth, vec_t threshold,
+    const std::function<void(int, const std::vector<uint8_t> *)> &trace);
+
 void ResetLtFace();
@@ -28,8 +28,8 @@
 
 #include <light/light.hh>
 
-#include <set>
 #include <map>
+#include <span>
 #include <vector>
 
 #include <common/qvec.hh>
@@ -42,9 +42,10 @@ struct neighbour_t
 
 void CalculateVertexNormals(const mbsp_t *bsp);
 const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f, const int vertindex);
-bool FacesSmoothed(const mface_t *f1, const mface_t *f2);
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face);
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face);
+bool FacesSmoothed(const mbsp_t *bsp, const mface_t *f1, const mface_t *f2);
+// faces `face` is smoothed with, sorted by face number
+std::span<const mface_t *const> GetSmoothFaces(const mbsp_t *bsp, const mface_t *face);
+std::span<const mface_t *const> GetPlaneFaces(const mface_t *face);
 const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex);
 int Q2_FacePhongValue(const mbsp_t *bsp, const mface_t *face);
 
@@ -52,7 +53,7 @@ int Q2_FacePhongValue(const mbsp_t *bsp, const mface_t *face);
 using edgeToFaceMap_t = std::map<std::pair<int, int>, std::vector<const mface_t *>>;
 
 std::vector<neighbour_t> NeighbouringFaces_new(const mbsp_t *bsp, const mface_t *face);
-std::vector<const mface_t *> FacesUsingVert(int vertnum);
+std::span<const mface_t *const> FacesUsingVert(int vertnum);
 const edgeToFaceMap_t &GetEdgeToFaceMap();
 
 class face_cache_t
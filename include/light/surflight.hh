@@ -20,6 +20,10 @@ See file, 'COPYING', for details.
 
 #pragma once
 
+#include <common/polylib.hh>
+
+#include <array>
+#include <span>
 #include <vector>
 #include <tuple>
 
@@ -49,10 +53,85 @@ struct surfacelight_t
     bool rescale;
 };
 
+/*
+ * A node of a surfacelight_tree_t, bounding every light below it.
+ */
+struct surfacelight_tree_node_t
+{
+    // bounds of the lights' points, of their `pos` and of their estimated visible areas
+    aabb3d bounds, pos_bounds, vis_bounds;
+
+    // color * totalintensity: the largest of any one light, and the sum.
+    // [0] is for the directional lights, [1] for the omnidirectional ones, since they
+    // are scaled differently
+    std::array<qvec3f, 2> max_power{}, total_power{};
+
+    // cone around the normals of the lights; cone_cos is -1 if any of them are omnidirectional
+    qvec3f cone_axis{};
+    float cone_cos = -1;
+
+    // for leafs, the light; otherwise the brightest light below, which stands in for
+    // the whole node when it's shaded as part of a cut
+    int32_t light = -1;
+    // -1 for leafs
+    std::array<int32_t, 2> children{-1, -1};
+
+    inline bool is_leaf() const { return children[0] == -1; }
+};
+
+/*
+ * Light tree over a set of surface lights (lightcuts style), one tree per
+ * style since lights of different styles can't stand in for each other.
+ */
+struct surfacelight_tree_t
+{
+    std::vector<surfacelight_tree_node_t> nodes;
+    std::vector<int32_t> roots;
+};
+
+surfacelight_tree_t MakeSurfaceLightTree(const std::vector<surfacelight_t> &lights);
+
 class light_t;
+class modelinfo_t;
+
+/*
+ * One face's share of a surface light. Adjacent coplanar faces with the
+ * same emission settings are merged into one light before dicing.
+ */
+struct surfacelight_emitter_t
+{
+    int32_t facenum;
+
+    // faces only merge when all of these match; source is -1 for Q2 surface
+    // flags, otherwise the index of the matching template
+    int32_t source;
+    int32_t texinfo;
+    int64_t planenum;
+    int32_t side;
+    const modelinfo_t *model;
+
+    // vertex indices; faces sharing one are neighbours
+    std::vector<int32_t> vertices;
+
+    polylib::winding_t winding;
+    float area;
+    qvec3d normal;
+    // winding center, lifted 1 unit
+    qvec3d midpoint;
+    qvec3f color;
+    float intensity;
+    bool omnidirectional;
+    int32_t style;
+    bool rescale;
+};
+
+std::vector<std::vector<int32_t>> GroupSurfaceLightEmitters(const std::vector<surfacelight_emitter_t> &emitters);
+surfacelight_t MakeSurfaceLight(const settings::worldspawn_keys &cfg,
+    const std::vector<surfacelight_emitter_t> &emitters, const std::vector<int32_t> &group);
 
 void ResetSurflight();
 std::vector<surfacelight_t> &GetSurfaceLights();
+const surfacelight_tree_t &GetSurfaceLightTree();
 std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(const mbsp_t *bsp, const mface_t *face);
-const std::vector<int> &SurfaceLightsForFaceNum(int facenum);
+std::span<const int> SurfaceLightsForFaceNum(int facenum);
 void MakeRadiositySurfaceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
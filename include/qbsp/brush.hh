@@ -28,6 +28,8 @@
 #include <vector>
 #include <memory>
 
+#include <tbb/scalable_allocator.h>
+
 class mapentity_t;
 struct maptexinfo_t;
 struct mapface_t;
@@ -43,8 +45,6 @@ struct side_t
     bool bevel; // don't ever use for bsp splitting
     mapface_t *source; // the mapface we were generated from
 
-    bool tested;
-
     side_t clone_non_winding_data() const;
     side_t clone() const;
 
@@ -61,11 +61,17 @@ struct bspbrush_t
     using ptr = std::shared_ptr<bspbrush_t>;
     using container = std::vector<ptr>;
     using list = std::list<ptr>;
+    // brush fragments are created and destroyed constantly during BrushBSP
+    // from many threads at once; keep them (and their side vectors) in
+    // tbbmalloc's per-thread pools instead of the global heap.
+    using allocator = tbb::scalable_allocator<bspbrush_t>;
+    using side_container = std::vector<side_t, tbb::scalable_allocator<side_t>>;
 
     template<typename... Args>
     static inline ptr make_ptr(Args&& ...args)
     {
-        return std::make_shared<bspbrush_t>(std::forward<Args>(args)...);
+        // allocate_shared places the control block and the brush in a single allocation
+        return std::allocate_shared<bspbrush_t>(allocator(), std::forward<Args>(args)...);
     }
 
     /**
@@ -80,7 +86,7 @@ struct bspbrush_t
 
     aabb3d bounds;
     int side, testside; // side of node during construction
-    std::vector<side_t> sides;
+    side_container sides;
     contentflags_t contents; /* BSP contents */
 
     qvec3d sphere_origin;
@@ -95,7 +95,10 @@ enum tree_split_t
     // to make a good BSP tree
     PRECISE,
     // always use faster methods to create the tree
-    FAST
+    FAST,
+    // always use a binned surface area heuristic; similar cost
+    // to FAST, but gives shallower, better balanced trees
+    SAH
 };
 
 vec_t BrushVolume(const bspbrush_t &brush);
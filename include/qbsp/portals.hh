@@ -27,6 +27,7 @@
 
 #include <atomic>
 #include <memory>
+#include <vector>
 
 struct side_t;
 struct tree_t;
@@ -72,9 +73,9 @@ bool Portal_EntityFlood(const portal_t *p, int32_t s);
 enum class portaltype_t {
     TREE, VIS
 };
-std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std::list<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock);
+std::vector<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std::vector<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock);
 void MakeTreePortals(tree_t &tree);
-std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree);
-void MakePortalsFromBuildportals(tree_t &tree, std::list<buildportal_t> &buildportals);
+std::vector<buildportal_t> MakeHeadnodePortals(tree_t &tree);
+void MakePortalsFromBuildportals(tree_t &tree, std::vector<buildportal_t> &buildportals);
 void EmitAreaPortals(node_t *headnode);
 void MarkVisibleSides(tree_t &tree, bspbrush_t::container &brushes);
@@ -190,6 +190,7 @@ public:
     setting_enum<conversion_t> convertmapformat;
     setting_invertible_bool oldaxis;
     setting_bool forcegoodtree;
+    setting_bool sahsplit;
     setting_scalar midsplitsurffraction;
     setting_int32 maxnodesize;
     setting_bool oldrottex;
@@ -208,6 +209,8 @@ public:
     setting_scalar worldextent;
     setting_int32 leakdist;
     setting_bool forceprt1;
+    setting_bool binaryprt;
+    setting_bool memoryprt;
     setting_tjunc tjunc;
     setting_bool objexport;
     setting_bool wrbrushes;
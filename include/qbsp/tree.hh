@@ -23,6 +23,7 @@
 
 #include <qbsp/qbsp.hh>
 #include <qbsp/brush.hh>
+#include <qbsp/portals.hh>
 
 #include <common/qvec.hh>
 
@@ -31,7 +32,6 @@
 
 #include <tbb/concurrent_vector.h>
 
-struct portal_t;
 struct tree_t;
 
 void FreeTreePortals(tree_t &tree);
@@ -43,7 +43,10 @@ struct tree_t
     aabb3d bounds;
 
     // here for ownership/memory management - not intended to be iterated directly
-    std::vector<std::unique_ptr<portal_t>> portals;
+    //
+    // portals are stored in place, like `nodes`, so a tree's portals are a few
+    // large blocks that clear() releases together instead of one allocation each.
+    tbb::concurrent_vector<portal_t> portals;
 
     // here for ownership/memory management - not intended to be iterated directly
     //
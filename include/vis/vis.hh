@@ -202,14 +202,19 @@ extern fs::path portalfile, statefile, statetmpfile;
 void BasePortalVis(void);
 
 void PortalFlow(visportal_t *p);
+void ResetSeparatorCache();
+void PrintSeparatorCacheStats();
 
 void CalcAmbientSounds(mbsp_t *bsp);
 
+int MergeSmallClusters(prtfile_t &prtfile, const std::vector<mleaf_t> &dleafs, vec_t max_volume, size_t max_portals);
+
 void CalcPHS(mbsp_t *bsp);
 
 extern time_point starttime, endtime, statetime;
 
 void SaveVisState(void);
+void WaitVisState(void);
 bool LoadVisState(void);
 void CleanVisState(void);
 
@@ -235,6 +240,12 @@ public:
     setting_scalar visdist{
         this, "visdist", 0.0, &vis_advanced_group, "control the distance required for a portal to be considered seen"};
     setting_bool nostate{this, "nostate", false, &vis_advanced_group, "ignore saved state files, for forced re-runs"};
+    setting_scalar mergevolume{this, "mergevolume", 0.0, &vis_advanced_group,
+        "merge clusters with a bounding box volume below n into a neighbouring cluster before flow (Q1 only)"};
+    setting_int32 mergeportals{this, "mergeportals", 64, 1, MAX_PORTALS_ON_LEAF, &vis_advanced_group,
+        "maximum number of portals a cluster merged by -mergevolume can end up with"};
+    setting_int32 separatorcache{this, "separatorcache", 0, 0, std::numeric_limits<int32_t>::max(),
+        &vis_advanced_group, "number of portal pairs to cache separating planes for, 0 to disable"};
     setting_bool phsonly{
         this, "phsonly", false, &vis_advanced_group, "re-calculate the PHS of a Quake II BSP without touching the PVS"};
     setting_invertible_bool autoclean{
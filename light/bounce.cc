@@ -32,7 +32,7 @@
 
 #include <vector>
 #include <unordered_map>
-#include <mutex>
+#include <iterator>
 
 #include <common/qvec.hh>
 #include <common/parallel.hh>
@@ -40,13 +40,14 @@
 using namespace std;
 using namespace polylib;
 
-mutex bouncelights_lock;
 static std::vector<surfacelight_t> bouncelights;
 static std::atomic_size_t bouncelightpoints;
+static surfacelight_tree_t bouncelighttree;
 
 void ResetBounce()
 {
     bouncelights.clear();
+    bouncelighttree = {};
     bouncelightpoints = 0;
 }
 
@@ -85,7 +86,7 @@ static bool Face_ShouldBounce(const mbsp_t *bsp, const mface_t *face)
 }
 
 static void MakeBounceLight(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, const mface_t *face,
-    qvec3d texture_color, int32_t style, const std::vector<qvec3f> &points, const winding_t &winding, const vec_t &area,
+    std::vector<surfacelight_t> &lights, qvec3d texture_color, int32_t style, const std::vector<qvec3f> &points, const winding_t &winding, const vec_t &area,
     const qvec3d &facenormal, const qvec3d &facemidpoint)
 {
     bouncelightpoints += points.size();
@@ -135,8 +136,7 @@ static void MakeBounceLight(const mbsp_t *bsp, const settings::worldspawn_keys &
     l.color = texture_color;
 
     // Store light...
-    unique_lock<mutex> lck{bouncelights_lock};
-    bouncelights.push_back(l);
+    lights.push_back(std::move(l));
 }
 
 const std::vector<surfacelight_t> &BounceLights()
@@ -144,7 +144,13 @@ const std::vector<surfacelight_t> &BounceLights()
     return bouncelights;
 }
 
-static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const mbsp_t *bsp, const mface_t &face)
+const surfacelight_tree_t &BounceLightTree()
+{
+    return bouncelighttree;
+}
+
+static void MakeBounceLightsThread(
+    const settings::worldspawn_keys &cfg, const mbsp_t *bsp, const mface_t &face, std::vector<surfacelight_t> &lights)
 {
     if (!Face_ShouldBounce(bsp, &face)) {
         return;
@@ -223,7 +229,7 @@ static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const m
         vector<qvec3f> points { facemidpoint };
 
         for (auto &style : emitcolors) {
-            MakeBounceLight(bsp, cfg, &face, style.second, style.first, points, winding, area, facenormal, facemidpoint);
+            MakeBounceLight(bsp, cfg, &face, lights, style.second, style.first, points, winding, area, facenormal, facemidpoint);
         }
     } else {
         vector<qvec3f> points;
@@ -231,7 +237,7 @@ static void MakeBounceLightsThread(const settings::worldspawn_keys &cfg, const m
             [&points, &faceplane](winding_t &w) { points.push_back(w.center() + faceplane.normal); });
 
         for (auto &style : emitcolors) {
-            MakeBounceLight(bsp, cfg, &face, style.second, style.first, points, winding, area, facenormal, facemidpoint);
+            MakeBounceLight(bsp, cfg, &face, lights, style.second, style.first, points, winding, area, facenormal, facemidpoint);
         }
     }
 }
@@ -240,7 +246,23 @@ void MakeBounceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
     logging::funcheader();
 
-    logging::parallel_for_each(bsp->dfaces, [&](const mface_t &face) { MakeBounceLightsThread(cfg, bsp, face); });
+    // per-face lists joined in face order, like MakeRadiositySurfaceLights
+    std::vector<std::vector<surfacelight_t>> lights_by_face(bsp->dfaces.size());
+
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+        [&](size_t i) { MakeBounceLightsThread(cfg, bsp, bsp->dfaces[i], lights_by_face[i]); });
+
+    size_t total = 0;
+    for (auto &lights : lights_by_face) {
+        total += lights.size();
+    }
+
+    bouncelights.reserve(total);
+    for (auto &lights : lights_by_face) {
+        std::move(lights.begin(), lights.end(), std::back_inserter(bouncelights));
+    }
+
+    bouncelighttree = MakeSurfaceLightTree(bouncelights);
 
     logging::print("{} bounce lights created, with {} points\n", bouncelights.size(), bouncelightpoints);
 }
@@ -164,6 +164,7 @@ worldspawn_keys::worldspawn_keys() :
     dirtScale{this, "dirtscale", 1.0, 0.0, 100.0, &worldspawn_group},
     dirtGain{this, "dirtgain", 1.0, 0.0, 100.0, &worldspawn_group},
     dirtAngle{this, "dirtangle", 88.0, 1.0, 90.0, &worldspawn_group},
+    dirtAdaptive{this, "dirtadaptive", 0.0, 0.0, 1.0, &worldspawn_group},
     minlightDirt{this, "minlight_dirt", false, &worldspawn_group},
     phongallowed{this, "phong", true, &worldspawn_group},
     phongangle{this, "phong_angle", 0, &worldspawn_group},
@@ -252,6 +253,8 @@ light_settings::light_settings()
     : surflight_dump{this, "surflight_dump", false, &debug_group, "dump surface lights to a .map file"},
       surflight_subdivide{
           this, "surflight_subdivide", 128.0, 1.0, 2048.0, &performance_group, "surface light subdivision size"},
+      surflight_error{this, "surflight_error", 0.0, 0.0, 255.0, &performance_group,
+          "shade far away groups of surface/bounce lights as one light when their total contribution is below n; 0 = exact"},
       onlyents{this, "onlyents", false, &output_group, "only update entities"},
       write_normals{this, "wrnormals", false, &output_group, "output normals, tangents and bitangents in a BSPX lump"},
       novanilla{this, "novanilla", false, &experimental_group, "implies -bspxlit; don't write vanilla lighting"},
@@ -306,6 +309,8 @@ light_settings::light_settings()
       exportobj{this, "exportobj", false, &output_group, "export an .OBJ for inspection"},
       lmshift{this, "lmshift", 4, &output_group,
           "force a specified lmshift to be applied to the entire map; this is useful if you want to re-light a map with higher quality BSPX lighting without the sources. Will add the LMSHIFT lump to the BSP."},
+      deterministic{this, "deterministic", false, &output_group,
+          "store the lightmaps in face order, so the output is identical regardless of the thread count"},
       dirtdebug{this, {"dirtdebug", "debugdirt"},
           [&](source) {
               CheckNoDebugModeSet();
@@ -489,6 +494,9 @@ void FixupGlobalSettings()
 
 static std::mutex light_mutex;
 
+// for -deterministic: the start of every GetFileSpace allocation, in greyscale samples
+static std::vector<int> file_space_starts;
+
 /*
  * Return space for the lightmap and colourmap at the same time so it can
  * be done in a thread-safe manner.
@@ -512,6 +520,10 @@ void GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata,
         *deluxdata = lux_filebase.data() + lux_file_p;
     }
 
+    if (light_options.deterministic.value()) {
+        file_space_starts.push_back(filebase.empty() ? lit_file_p / 3 : file_p);
+    }
+
     // if size isn't a multiple of 4, round up to the next multiple of 4
     if ((size % 4) != 0) {
         size += (4 - (size % 4));
@@ -639,6 +651,9 @@ static void CreateLightmapSurfaces(mbsp_t *bsp)
 {
     light_surfaces.resize(bsp->dfaces.size());
     logging::funcheader();
+
+    SetupLeafPvsCache(bsp);
+
     logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&bsp](size_t i) {
         auto facesup = faces_sup.empty() ? nullptr : &faces_sup[i];
         auto facesup_decoupled = facesup_decoupled_global.empty() ? nullptr : &facesup_decoupled_global[i];
@@ -670,6 +685,91 @@ static void CreateLightmapSurfaces(mbsp_t *bsp)
     });
 }
 
+/*
+ * GetFileSpace hands out space in whatever order the threads save their faces; for
+ * -deterministic, move the lightmaps so they're stored in face order instead.
+ */
+static void SortLightmapsByFace(mbsp_t *bsp)
+{
+    // all of the buffers are allocated in lockstep, so work in greyscale samples;
+    // lightofs is in bytes of the rgb buffer for Q2/HL
+    const bool rgb = bsp->loadversion->game->has_rgb_lightmap;
+    const int scale = rgb ? 3 : 1;
+    const int end = (rgb ? lit_file_p : file_p) / scale;
+
+    // every allocation runs up to the next one
+    const std::vector<int> &starts = file_space_starts;
+
+    // the offsets referring to them, in the order they'll be stored in
+    std::vector<int32_t *> refs;
+
+    for (size_t i = 0; i < bsp->dfaces.size(); i++) {
+        refs.push_back(&bsp->dfaces[i].lightofs);
+
+        if (!faces_sup.empty()) {
+            refs.push_back(&faces_sup[i].lightofs);
+        }
+        if (!facesup_decoupled_global.empty()) {
+            refs.push_back(&facesup_decoupled_global[i].offset);
+        }
+    }
+
+    std::vector<int> moved_to(starts.size(), -1);
+    std::vector<uint8_t> sorted_light(filebase.empty() ? 0 : end);
+    std::vector<uint8_t> sorted_lit(lit_filebase.empty() ? 0 : end * 3);
+    std::vector<uint8_t> sorted_lux(lux_filebase.empty() ? 0 : end * 3);
+    int cursor = 0;
+
+    for (int32_t *ref : refs) {
+        if (*ref < 0) {
+            continue;
+        }
+
+        auto it = std::lower_bound(starts.begin(), starts.end(), *ref / scale);
+
+        if (it == starts.end() || *it != *ref / scale) {
+            // not something we allocated (e.g. left over from a previous run)
+            continue;
+        }
+
+        const size_t index = it - starts.begin();
+
+        if (moved_to[index] == -1) {
+            const int start = starts[index];
+            const int size = (index + 1 < starts.size() ? starts[index + 1] : end) - start;
+
+            if (!sorted_light.empty()) {
+                memcpy(sorted_light.data() + cursor, filebase.data() + start, size);
+            }
+            if (!sorted_lit.empty()) {
+                memcpy(sorted_lit.data() + cursor * 3, lit_filebase.data() + start * 3, size * 3);
+            }
+            if (!sorted_lux.empty()) {
+                memcpy(sorted_lux.data() + cursor * 3, lux_filebase.data() + start * 3, size * 3);
+            }
+
+            moved_to[index] = cursor;
+            cursor += size;
+        }
+
+        *ref = moved_to[index] * scale;
+    }
+
+    std::copy(sorted_light.begin(), sorted_light.begin() + (sorted_light.empty() ? 0 : cursor), filebase.begin());
+    std::copy(sorted_lit.begin(), sorted_lit.begin() + (sorted_lit.empty() ? 0 : cursor * 3), lit_filebase.begin());
+    std::copy(sorted_lux.begin(), sorted_lux.begin() + (sorted_lux.empty() ? 0 : cursor * 3), lux_filebase.begin());
+
+    if (!filebase.empty()) {
+        file_p = cursor;
+    }
+    if (!lit_filebase.empty()) {
+        lit_file_p = cursor * 3;
+    }
+    if (!lux_filebase.empty()) {
+        lux_file_p = cursor * 3;
+    }
+}
+
 static void SaveLightmapSurfaces(mbsp_t *bsp)
 {
     logging::funcheader();
@@ -707,6 +807,10 @@ static void SaveLightmapSurfaces(mbsp_t *bsp)
 
         light_surfaces[i].reset();
     });
+
+    if (light_options.deterministic.value() && !light_options.litonly.value()) {
+        SortLightmapsByFace(bsp);
+    }
 }
 
 static void FindModelInfo(const mbsp_t *bsp)
@@ -801,6 +905,7 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
     mbsp_t &bsp = std::get<mbsp_t>(bspdata->bsp);
 
     light_surfaces.clear();
+    file_space_starts.clear();
     filebase.clear();
     lit_filebase.clear();
     lux_filebase.clear();
@@ -34,6 +34,7 @@
 #include <cmath>
 #include <algorithm>
 #include <fstream>
+#include <mutex>
 #include <fmt/ostream.h>
 
 using namespace std;
@@ -522,8 +523,57 @@ static bool Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf, uint8_t *out)
     return true;
 }
 
+/*
+ * Decompressed PVS rows shared by all lightsurfs: one per leaf (Q1) or per
+ * cluster (Q2), each decompressed the first time a lightsurf asks for it.
+ */
+struct leaf_pvs_cache_t
+{
+    size_t rowsize = 0;
+    std::vector<uint8_t> all_visible;
+    std::unique_ptr<std::once_flag[]> once;
+    std::vector<std::unique_ptr<uint8_t[]>> rows;
+};
+
+static leaf_pvs_cache_t leaf_pvs_cache;
+
+void SetupLeafPvsCache(const mbsp_t *bsp)
+{
+    const size_t numrows =
+        bsp->loadversion->game->id == GAME_QUAKE_II ? bsp->dvis.bit_offsets.size() : bsp->dleafs.size();
+
+    leaf_pvs_cache = {};
+    leaf_pvs_cache.rowsize = DecompressedVisSize(bsp);
+    leaf_pvs_cache.all_visible.assign(leaf_pvs_cache.rowsize, 0xff);
+    leaf_pvs_cache.once = std::make_unique<std::once_flag[]>(numrows);
+    leaf_pvs_cache.rows.resize(numrows);
+}
+
+// returns the (shared) decompressed pvs of the leaf
+static const uint8_t *LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf)
+{
+    const ptrdiff_t row =
+        bsp->loadversion->game->id == GAME_QUAKE_II ? leaf->cluster : (leaf - bsp->dleafs.data());
+
+    // no vis data for the leaf; treat it as seeing everything
+    if (row < 0 || row >= leaf_pvs_cache.rows.size()) {
+        return leaf_pvs_cache.all_visible.data();
+    }
+
+    std::call_once(leaf_pvs_cache.once[row], [&]() {
+        uint8_t *out = (leaf_pvs_cache.rows[row] = std::make_unique<uint8_t[]>(leaf_pvs_cache.rowsize)).get();
+
+        // same for a leaf in range that has none (visofs < 0, the solid leaf)
+        if (!Mod_LeafPvs(bsp, leaf, out)) {
+            std::fill_n(out, leaf_pvs_cache.rowsize, 0xff);
+        }
+    });
+
+    return leaf_pvs_cache.rows[row].get();
+}
+
 // returns true if pvs can see leaf
-static bool Pvs_LeafVisible(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *leaf)
+static bool Pvs_LeafVisible(const mbsp_t *bsp, const uint8_t *pvs, const mleaf_t *leaf)
 {
     if (bsp->loadversion->game->id == GAME_QUAKE_II) {
         if (leaf->cluster < 0) {
@@ -556,15 +606,14 @@ static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
     const mleaf_t *lastleaf = nullptr;
 
     // set defaults
-    lightsurf->pvs.clear();
+    lightsurf->pvs = nullptr;
+    lightsurf->merged_pvs.clear();
 
     if (!bsp->dvis.bits.size()) {
         return;
     }
 
-    // set lightsurf->pvs
-    uint8_t *pointpvs = (uint8_t *)alloca(pvssize);
-    lightsurf->pvs.resize(pvssize);
+    Q_assert(leaf_pvs_cache.rowsize == pvssize);
 
     for (int i = 0; i < lightsurf->points.size(); i++) {
         const mleaf_t *leaf = Light_PointInLeaf(bsp, lightsurf->points[i]);
@@ -575,22 +624,30 @@ static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
 
         lastleaf = leaf;
 
-        /* copy the pvs for this leaf into pointpvs */
-        Mod_LeafPvs(bsp, leaf, pointpvs);
-
         if (bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
             // hack for when the sample point might be in an opaque liquid, blocking vis,
             // but we typically want light to pass through these.
             // see also VisCullEntity() which handles the case when the light emitter is in liquid.
-            for (int j = 0; j < pvssize; j++) {
-                lightsurf->pvs[j] |= 0xff;
-            }
+            lightsurf->merged_pvs.clear();
+            lightsurf->pvs = leaf_pvs_cache.all_visible.data();
             break;
         }
 
+        const uint8_t *pointpvs = LeafPvs(bsp, leaf);
+
+        /* a surface in a single leaf just references the leaf's pvs */
+        if (!lightsurf->pvs || lightsurf->pvs == pointpvs) {
+            lightsurf->pvs = pointpvs;
+            continue;
+        }
+
         /* merge the pvs for this sample point into lightsurf->pvs */
+        if (lightsurf->merged_pvs.empty()) {
+            lightsurf->merged_pvs.assign(lightsurf->pvs, lightsurf->pvs + pvssize);
+            lightsurf->pvs = lightsurf->merged_pvs.data();
+        }
         for (int j = 0; j < pvssize; j++) {
-            lightsurf->pvs[j] |= pointpvs[j];
+            lightsurf->merged_pvs[j] |= pointpvs[j];
         }
     }
 }
@@ -1145,9 +1202,9 @@ inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     return fabs(GetLightValue(cfg, entity, dist)) <= light_options.gate.value();
 }
 
-static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *entleaf)
+static bool VisCullEntity(const mbsp_t *bsp, const uint8_t *pvs, const mleaf_t *entleaf)
 {
-    if (pvs.empty()) {
+    if (!pvs) {
         return false;
     }
     if (entleaf == nullptr) {
@@ -1762,88 +1819,263 @@ SurfaceLight_SphereCull(const surfacelight_t *vpl, const lightsurf_t *lightsurf,
     return qv::gate(color, (float) bouncelight_gate);
 }
 
-static void // mxd
-LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps, const std::vector<surfacelight_t> &surface_lights, const vec_t &standard_scale, const vec_t &sky_scale, const float &hotspot_clamp)
+/*
+ * Traces and adds one surface light's contribution to the lightsurf. `scale`
+ * multiplies its color; it's 1 except when the light stands in for a whole
+ * light tree node.
+ */
+static void SurfaceLight_Shade(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps,
+    const surfacelight_t &vpl, const qvec3f &scale, const vec_t &standard_scale, const vec_t &sky_scale,
+    const float &hotspot_clamp, const float &surflight_gate)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
-    const float surflight_gate = 0.01f;
+    raystream_occlusion_t &rs = lightsurf->occlusion_stream;
 
-    // check lighting channels (currently surface lights are always on CHANNEL_MASK_DEFAULT)
-    if (!(lightsurf->modelinfo->object_channel_mask.value() & CHANNEL_MASK_DEFAULT)) {
-        return;
-    }
+    for (int c = 0; c < vpl.points.size(); c++) {
+        if (light_options.visapprox.value() == visapprox_t::VIS &&
+            VisCullEntity(bsp, lightsurf->pvs, vpl.leaves[c])) {
+            continue;
+        }
+
+        rs.clearPushedRays();
+
+        for (int i = 0; i < lightsurf->points.size(); i++) {
+            if (lightsurf->occluded[i])
+                continue;
+
+            const qvec3d &lightsurf_pos = lightsurf->points[i];
+            const qvec3d &lightsurf_normal = lightsurf->normals[i];
+
+            qvec3f pos = vpl.points[c];
+            qvec3f dir = lightsurf_pos - pos;
+            float dist = qv::length(dir);
+
+            if (dist == 0.0f)
+                dir = lightsurf_normal;
+            else
+                dir /= dist;
+
+            const qvec3f indirect = GetSurfaceLighting(cfg, &vpl, dir, dist, lightsurf_normal, standard_scale, sky_scale, hotspot_clamp) * scale;
+            if (!qv::gate(indirect, surflight_gate)) { // Each point contributes very little to the final result
+                rs.pushRay(i, pos, dir, dist, &indirect);
+            }
+        }
 
-    for (const surfacelight_t &vpl : surface_lights) {
-        if (SurfaceLight_SphereCull(&vpl, lightsurf, surflight_gate, hotspot_clamp))
+        if (!rs.numPushedRays())
             continue;
 
-        raystream_occlusion_t &rs = lightsurf->occlusion_stream;
+        total_surflight_rays += rs.numPushedRays();
+        rs.tracePushedRaysOcclusion(lightsurf->modelinfo, CHANNEL_MASK_DEFAULT);
+
+        const int lightmapstyle = vpl.style;
+        lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, lightmapstyle, lightsurf);
 
-        for (int c = 0; c < vpl.points.size(); c++) {
-            if (light_options.visapprox.value() == visapprox_t::VIS &&
-                VisCullEntity(bsp, lightsurf->pvs, vpl.leaves[c])) {
+        bool hit = false;
+        const int numrays = rs.numPushedRays();
+        for (int j = 0; j < numrays; j++) {
+            if (rs.getPushedRayOccluded(j))
                 continue;
+
+            const int i = rs.getPushedRayPointIndex(j);
+            qvec3f indirect = rs.getPushedRayColor(j);
+
+            Q_assert(!std::isnan(indirect[0]));
+
+            // Use dirt scaling on the surface lighting.
+            const vec_t dirtscale = Dirt_GetScaleFactor(cfg, lightsurf->occlusion[i], nullptr, 0.0, lightsurf);
+            indirect *= dirtscale;
+
+            lightsample_t &sample = lightmap->samples[i];
+            sample.color += indirect;
+
+            hit = true;
+            ++total_surflight_ray_hits;
+        }
+
+        // If surface light contributed anything, save.
+        if (hit)
+            Lightmap_Save(lightmaps, lightsurf, lightmap, lightmapstyle);
+    }
+}
+
+// upper bound of the cosine between `axis` and any direction from a point in `from` to a point in `to`
+static vec_t SurfaceLight_MaxCosToBox(const qvec3f &axis, const aabb3d &from, const aabb3d &to)
+{
+    // box of all the `to - from` vectors
+    const qvec3d mins = to.mins() - from.maxs();
+    const qvec3d maxs = to.maxs() - from.mins();
+
+    vec_t max_dot = 0, min_len2 = 0, max_len2 = 0;
+
+    for (size_t i = 0; i < 3; i++) {
+        max_dot += axis[i] * (axis[i] >= 0 ? maxs[i] : mins[i]);
+
+        const vec_t nearest = std::clamp(0.0, mins[i], maxs[i]);
+        min_len2 += nearest * nearest;
+        max_len2 += std::max(mins[i] * mins[i], maxs[i] * maxs[i]);
+    }
+
+    if (max_dot > 0) {
+        return min_len2 > 0 ? std::min(1.0, max_dot / sqrt(min_len2)) : 1.0;
+    }
+
+    return max_len2 > 0 ? max_dot / sqrt(max_len2) : 1.0;
+}
+
+/*
+ * Light tree traversal for LightFace_SurfaceLight. Subtrees are skipped when
+ * no light below could pass SurfaceLight_SphereCull, or when all of the
+ * lights face away from the lightsurf; neither changes the result. With a
+ * nonzero surflight_error, a node whose whole contribution is bounded by the
+ * error is shaded with its brightest light, scaled up to the node's power,
+ * instead of descending further (a lightcut).
+ */
+struct surfacelight_cut_t
+{
+    const mbsp_t *bsp;
+    const lightsurf_t *lightsurf;
+    const std::vector<surfacelight_t> &lights;
+    const surfacelight_tree_t &tree;
+    vec_t standard_scale, sky_scale;
+    float hotspot_clamp, surflight_gate;
+    vec_t error;
+    aabb3d sample_bounds;
+
+    struct entry_t
+    {
+        int32_t light;
+        qvec3f scale;
+        // a single light, rather than the representative of a node
+        bool exact;
+    };
+
+    // lights to shade
+    std::vector<entry_t> &cut;
+
+    // v[0] is for directional lights, v[1] for omnidirectional ones, each
+    // scaled by its own surflightscale
+
+    // the brightest single light: max(v[0] * a, v[1] * b), per component
+    static qvec3f scaled_max_power(const std::array<qvec3f, 2> &v, vec_t a, vec_t b)
+    {
+        return qv::max(v[0] * static_cast<float>(a), v[1] * static_cast<float>(b));
+    }
+
+    // all of the lights: v[0] * a + v[1] * b
+    static qvec3f scaled_total_power(const std::array<qvec3f, 2> &v, vec_t a, vec_t b)
+    {
+        return v[0] * static_cast<float>(a) + v[1] * static_cast<float>(b);
+    }
+
+    void walk(int32_t nodenum)
+    {
+        const surfacelight_tree_node_t &node = tree.nodes[nodenum];
+        const settings::worldspawn_keys &cfg = *lightsurf->cfg;
+
+        if (light_options.visapprox.value() == visapprox_t::RAYS &&
+            node.vis_bounds.disjoint(lightsurf->extents.bounds, 0.001)) {
+            return;
+        }
+
+        // the same bound as SurfaceLight_SphereCull for the closest `pos` in the node,
+        // with a unit of slack for its float math
+        {
+            const qvec3d origin = lightsurf->extents.origin;
+            const qvec3d nearest = qv::max(node.pos_bounds.mins(), qv::min(origin, node.pos_bounds.maxs()));
+            const vec_t dist = max(qv::distance(origin, nearest) - 1.0, 0.0) + lightsurf->extents.radius;
+            const vec_t d = max(dist, static_cast<vec_t>(hotspot_clamp));
+            const qvec3f bound = scaled_max_power(node.max_power, cfg.surflightscale.value(), cfg.surflightskyscale.value()) *
+                                 static_cast<float>(1.0 / (d * d));
+
+            if (qv::gate(bound, surflight_gate)) {
+                return;
             }
+        }
 
-            rs.clearPushedRays();
+        // every sample is behind every light
+        if (node.cone_cos > -1) {
+            const vec_t max_cos = SurfaceLight_MaxCosToBox(node.cone_axis, node.bounds, sample_bounds);
+            const vec_t angle = max(0.0, acos(std::clamp(max_cos, -1.0, 1.0)) - acos(std::clamp(static_cast<vec_t>(node.cone_cos), -1.0, 1.0)));
 
-            for (int i = 0; i < lightsurf->points.size(); i++) {
-                if (lightsurf->occluded[i])
-                    continue;
+            if (cos(angle) < -LIGHT_ANGLE_EPSILON - 0.001) {
+                return;
+            }
+        }
 
-                const qvec3d &lightsurf_pos = lightsurf->points[i];
-                const qvec3d &lightsurf_normal = lightsurf->normals[i];
+        if (node.is_leaf()) {
+            cut.push_back({node.light, qvec3f(1.0f), true});
+            return;
+        }
 
-                qvec3f pos = vpl.points[c];
-                qvec3f dir = lightsurf_pos - pos;
-                float dist = qv::length(dir);
+        if (error > 0) {
+            // distance between the light points and the samples
+            qvec3d gap;
+            for (size_t i = 0; i < 3; i++) {
+                gap[i] = max({0.0, node.bounds.mins()[i] - sample_bounds.maxs()[i],
+                    sample_bounds.mins()[i] - node.bounds.maxs()[i]});
+            }
+            const vec_t d = max(qv::length(gap), static_cast<vec_t>(hotspot_clamp));
+            const qvec3f total = scaled_total_power(node.total_power, standard_scale, sky_scale);
 
-                if (dist == 0.0f)
-                    dir = lightsurf_normal;
-                else
-                    dir /= dist;
+            if (qv::gate(total * static_cast<float>(1.0 / (d * d)), static_cast<float>(error))) {
+                const surfacelight_t &rep = lights[node.light];
+                const qvec3f rep_power = qvec3f(rep.color) * rep.totalintensity *
+                                         static_cast<float>(rep.omnidirectional ? sky_scale : standard_scale);
+                qvec3f scale;
 
-                const qvec3f indirect = GetSurfaceLighting(cfg, &vpl, dir, dist, lightsurf_normal, standard_scale, sky_scale, hotspot_clamp);
-                if (!qv::gate(indirect, surflight_gate)) { // Each point contributes very little to the final result
-                    rs.pushRay(i, pos, dir, dist, &indirect);
+                for (size_t i = 0; i < 3; i++) {
+                    scale[i] = rep_power[i] > 0 ? total[i] / rep_power[i] : 0.0f;
                 }
+
+                cut.push_back({node.light, scale, false});
+                return;
             }
+        }
 
-            if (!rs.numPushedRays())
-                continue;
+        walk(node.children[0]);
+        walk(node.children[1]);
+    }
+};
 
-            total_surflight_rays += rs.numPushedRays();
-            rs.tracePushedRaysOcclusion(lightsurf->modelinfo, CHANNEL_MASK_DEFAULT);
+static void // mxd
+LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps, const std::vector<surfacelight_t> &surface_lights, const surfacelight_tree_t &tree, const vec_t &standard_scale, const vec_t &sky_scale, const float &hotspot_clamp)
+{
+    const float surflight_gate = 0.01f;
 
-            const int lightmapstyle = vpl.style;
-            lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, lightmapstyle, lightsurf);
+    // check lighting channels (currently surface lights are always on CHANNEL_MASK_DEFAULT)
+    if (!(lightsurf->modelinfo->object_channel_mask.value() & CHANNEL_MASK_DEFAULT)) {
+        return;
+    }
 
-            bool hit = false;
-            const int numrays = rs.numPushedRays();
-            for (int j = 0; j < numrays; j++) {
-                if (rs.getPushedRayOccluded(j))
-                    continue;
+    if (tree.roots.empty()) {
+        return;
+    }
+
+    static thread_local std::vector<surfacelight_cut_t::entry_t> cut;
+    cut.clear();
 
-                const int i = rs.getPushedRayPointIndex(j);
-                qvec3f indirect = rs.getPushedRayColor(j);
+    surfacelight_cut_t walker{bsp, lightsurf, surface_lights, tree, standard_scale, sky_scale, hotspot_clamp,
+        surflight_gate, light_options.surflight_error.value(), {}, cut};
 
-                Q_assert(!std::isnan(indirect[0]));
+    for (auto &pt : lightsurf->points) {
+        walker.sample_bounds += pt;
+    }
 
-                // Use dirt scaling on the surface lighting.
-                const vec_t dirtscale = Dirt_GetScaleFactor(cfg, lightsurf->occlusion[i], nullptr, 0.0, lightsurf);
-                indirect *= dirtscale;
+    for (int32_t root : tree.roots) {
+        walker.walk(root);
+    }
 
-                lightsample_t &sample = lightmap->samples[i];
-                sample.color += indirect;
+    // shade in light order, so the sums are the same as going through the whole list
+    std::sort(cut.begin(), cut.end(), [](auto &a, auto &b) { return a.light < b.light; });
 
-                hit = true;
-                ++total_surflight_ray_hits;
-            }
+    for (auto &entry : cut) {
+        const surfacelight_t &vpl = surface_lights[entry.light];
 
-            // If surface light contributed anything, save.
-            if (hit)
-                Lightmap_Save(lightmaps, lightsurf, lightmap, lightmapstyle);
-        }
+        if (entry.exact && SurfaceLight_SphereCull(&vpl, lightsurf, surflight_gate, hotspot_clamp))
+            continue;
+
+        SurfaceLight_Shade(
+            bsp, lightsurf, lightmaps, vpl, entry.scale, standard_scale, sky_scale, hotspot_clamp, surflight_gate);
     }
 }
 
@@ -2008,15 +2240,29 @@ inline qvec3d TransformToTangentSpace(
     return myRt * inputvec[0] + myUp * inputvec[1] + normal * inputvec[2];
 }
 
+// maps `x` to a float in [0, 1)
+inline float HashToUnitFloat(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
 // from q3map2
-inline qvec3d GetDirtVector(const settings::worldspawn_keys &cfg, int i)
+// `seed` identifies the sample point; random vectors are hashed from it and `i` rather
+// than taken from rand(), which isn't thread safe and depends on thread scheduling
+inline qvec3d GetDirtVector(const settings::worldspawn_keys &cfg, int i, uint32_t seed)
 {
     Q_assert(i < numDirtVectors);
 
     if (cfg.dirtMode.value() == 1) {
         /* get random vector */
-        float angle = Random() * DEG2RAD(360.0f);
-        float elevation = Random() * DEG2RAD(cfg.dirtAngle.value());
+        const uint32_t key = (seed * static_cast<uint32_t>(DIRT_NUM_VECTORS) + i) * 2;
+        float angle = HashToUnitFloat(key) * DEG2RAD(360.0f);
+        float elevation = HashToUnitFloat(key + 1) * DEG2RAD(cfg.dirtAngle.value());
         return {cos(angle) * sin(elevation), sin(angle) * sin(elevation), cos(elevation)};
     }
 
@@ -2037,36 +2283,48 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
     // batch implementation:
 
     thread_local static std::vector<qvec3d> myUps, myRts;
+    thread_local static std::vector<uint8_t> refine;
+
+    const size_t numpoints = lightsurf->points.size();
 
-    myUps.resize(lightsurf->points.size());
-    myRts.resize(lightsurf->points.size());
+    myUps.resize(numpoints);
+    myRts.resize(numpoints);
 
     // init
-    for (int i = 0; i < lightsurf->points.size(); i++) {
+    for (int i = 0; i < numpoints; i++) {
         lightsurf->occlusion[i] = 0;
     }
 
     // this stuff is just per-point
-    for (int i = 0; i < lightsurf->points.size(); i++) {
+    for (int i = 0; i < numpoints; i++) {
         GetUpRtVecs(lightsurf->normals[i], myUps[i], myRts[i]);
     }
 
-    for (int j = 0; j < numDirtVectors; j++) {
+    // for dirtmode 1
+    const uint32_t seed = static_cast<uint32_t>(Face_GetNum(lightsurf->bsp, lightsurf->face)) << 16;
+
+    // traces dirt vector `j` from every point (or only the ones flagged in `only`)
+    auto traceDirtVector = [&](int j, const std::vector<uint8_t> *only) {
         raystream_intersection_t &rs = lightsurf->intersection_stream;
         rs.clearPushedRays();
 
         // fill in input buffers
 
-        for (int i = 0; i < lightsurf->points.size(); i++) {
+        for (int i = 0; i < numpoints; i++) {
             if (lightsurf->occluded[i])
                 continue;
+            if (only && !(*only)[i])
+                continue;
 
-            qvec3d dirtvec = GetDirtVector(cfg, j);
+            qvec3d dirtvec = GetDirtVector(cfg, j, seed + i);
             qvec3d dir = TransformToTangentSpace(lightsurf->normals[i], myUps[i], myRts[i], dirtvec);
 
             rs.pushRay(i, lightsurf->points[i], dir, cfg.dirtDepth.value());
         }
 
+        if (!rs.numPushedRays())
+            return;
+
         // trace the batch. need closest hit for dirt, so intersection.
         //
         // use the model's own channel mask as the shadow mask, e.g. so a model in channel 2's AO rays will only hit
@@ -2083,12 +2341,89 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
                 lightsurf->occlusion[i] += cfg.dirtDepth.value();
             }
         }
+    };
+
+    // adaptive dirt needs the samples' grid neighbours
+    const vec_t threshold =
+        numpoints == static_cast<size_t>(lightsurf->width) * lightsurf->height ? cfg.dirtAdaptive.value() : 0.0;
+
+    CalculateDirtOcclusion(lightsurf->occlusion, refine, lightsurf->occluded, lightsurf->width, lightsurf->height,
+        numDirtVectors, cfg.dirtDepth.value(), threshold, traceDirtVector);
+}
+
+void CalculateDirtOcclusion(std::vector<float> &occlusion, std::vector<uint8_t> &refine,
+    const std::vector<bool> &occluded, int width, int height, int num_vectors, vec_t depth, vec_t threshold,
+    const std::function<void(int, const std::vector<uint8_t> *)> &trace)
+{
+    const size_t numpoints = occlusion.size();
+
+    if (!threshold || num_vectors <= DIRT_ADAPTIVE_STRIDE) {
+        refine.assign(numpoints, 1);
+
+        for (int j = 0; j < num_vectors; j++) {
+            trace(j, nullptr);
+        }
+
+        // process the results.
+        for (size_t i = 0; i < numpoints; i++) {
+            vec_t avgHitdist = occlusion[i] / (float)num_vectors;
+            occlusion[i] = 1 - (avgHitdist / depth);
+        }
+        return;
+    }
+
+    Q_assert(numpoints == static_cast<size_t>(width) * height);
+
+    /*
+     * adaptive: trace every DIRT_ADAPTIVE_STRIDE'th vector first, then the
+     * rest only at points whose coarse occlusion differs from a neighbouring
+     * sample's by more than the threshold
+     */
+    int numCoarse = 0;
+    for (int j = 0; j < num_vectors; j += DIRT_ADAPTIVE_STRIDE, numCoarse++) {
+        trace(j, nullptr);
+    }
+
+    auto coarseOcclusion = [&](int i) { return 1 - ((occlusion[i] / (float)numCoarse) / depth); };
+
+    refine.assign(numpoints, 0);
+
+    for (int t = 0; t < height; t++) {
+        for (int s = 0; s < width; s++) {
+            const int i = t * width + s;
+
+            if (occluded[i])
+                continue;
+
+            // compare against the right and lower neighbours; flag both samples of a differing pair
+            for (const int n : {s + 1 < width ? i + 1 : -1, t + 1 < height ? i + width : -1}) {
+                if (n == -1 || occluded[n])
+                    continue;
+
+                if (fabs(coarseOcclusion(i) - coarseOcclusion(n)) > threshold) {
+                    refine[i] = refine[n] = 1;
+                }
+            }
+        }
+    }
+
+    // refined points start over and trace every vector in order, so they sum to exactly
+    // what the non-adaptive path gives
+    for (size_t i = 0; i < numpoints; i++) {
+        if (refine[i]) {
+            occlusion[i] = 0;
+        }
+    }
+
+    for (int j = 0; j < num_vectors; j++) {
+        trace(j, &refine);
     }
 
     // process the results.
-    for (int i = 0; i < lightsurf->points.size(); i++) {
-        vec_t avgHitdist = lightsurf->occlusion[i] / (float)numDirtVectors;
-        lightsurf->occlusion[i] = 1 - (avgHitdist / cfg.dirtDepth.value());
+    for (size_t i = 0; i < numpoints; i++) {
+        const int numTraced = refine[i] ? num_vectors : numCoarse;
+        vec_t avgHitdist = occlusion[i] / (float)numTraced;
+        occlusion[i] = 1 - (avgHitdist / depth);
     }
 }
 
@@ -2237,26 +2572,24 @@ static void DumpDownscaledLightmap(const mbsp_t *bsp, const mface_t *face, int w
 }
 #endif
 
-static std::vector<qvec4f> LightmapColorsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
+static void LightmapColorsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm, std::vector<qvec4f> &res)
 {
-    std::vector<qvec4f> res;
+    res.resize(lightsurf->points.size());
     for (int i = 0; i < lightsurf->points.size(); i++) {
         const qvec3d &color = lm->samples[i].color;
         const float alpha = lightsurf->occluded[i] ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha);
+        res[i] = {(float)color[0], (float)color[1], (float)color[2], alpha};
     }
-    return res;
 }
 
-static std::vector<qvec4f> LightmapNormalsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
+static void LightmapNormalsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm, std::vector<qvec4f> &res)
 {
-    std::vector<qvec4f> res;
+    res.resize(lightsurf->points.size());
     for (int i = 0; i < lightsurf->points.size(); i++) {
         const qvec3d &color = lm->samples[i].direction;
         const float alpha = lightsurf->occluded[i] ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha);
+        res[i] = {(float)color[0], (float)color[1], (float)color[2], alpha};
     }
-    return res;
 }
 
 // Special handling of alpha channel:
@@ -2268,218 +2601,223 @@ static std::vector<qvec4f> LightmapNormalsToGLMVector(const lightsurf_t *lightsu
 // - If all the samples in the filter kernel have alpha=0, write a sample with alpha=0
 //   (but still average the colors, important so that minlight still works properly
 //    for bmodels that go outside of the world).
-static std::vector<qvec4f> IntegerDownsampleImage(const std::vector<qvec4f> &input, int w, int h, int factor)
+void IntegerDownsampleImage(const std::vector<qvec4f> &input, std::vector<qvec4f> &output, int w, int h, int factor)
 {
     Q_assert(factor >= 1);
-    if (factor == 1)
-        return input;
+    if (factor == 1) {
+        output = input;
+        return;
+    }
 
     const int outw = w / factor;
     const int outh = h / factor;
 
-    std::vector<qvec4f> res(static_cast<size_t>(outw * outh));
+    output.resize(static_cast<size_t>(outw * outh));
 
-    for (int y = 0; y < outh; y++) {
-        for (int x = 0; x < outw; x++) {
-
-            float totalWeight = 0.0f;
-            qvec3f totalColor{};
-
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion{};
+    // per output column: the color sum of the non-occluded samples (weight in
+    // [3]), and of all samples, used if every sample in the kernel has alpha = 0
+    thread_local std::vector<qvec4f> totals, totalsIgnoringOcclusion;
 
-            const int extraradius = 0;
-            const int kernelextent = factor + (2 * extraradius);
+    // one pass over the input; each output row accumulates `factor` input rows,
+    // adding the samples of an output pixel in the same order as a 2D loop would
+    for (int y = 0; y < outh; y++) {
+        totals.assign(outw, {});
+        totalsIgnoringOcclusion.assign(outw, {});
 
-            for (int y0 = 0; y0 < kernelextent; y0++) {
-                for (int x0 = 0; x0 < kernelextent; x0++) {
-                    const int x1 = (x * factor) - extraradius + x0;
-                    const int y1 = (y * factor) - extraradius + y0;
+        for (int y0 = 0; y0 < factor; y0++) {
+            const qvec4f *row = input.data() + static_cast<size_t>((y * factor) + y0) * w;
 
-                    // check if the kernel goes outside of the source image
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
+            for (int x = 0; x < outw; x++) {
+                qvec4f &total = totals[x];
+                qvec4f &totalIgnoringOcclusion = totalsIgnoringOcclusion[x];
 
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f &inSample = input.at((y1 * w) + x1);
+                for (int x0 = 0; x0 < factor; x0++) {
+                    const qvec4f &inSample = row[(x * factor) + x0];
+                    const qvec4f sample{inSample[0], inSample[1], inSample[2], 1.0f};
 
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
+                    totalIgnoringOcclusion += sample;
 
                     // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
-
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
+                    if (inSample[3] != 0.0f) {
+                        total += sample;
+                    }
                 }
             }
+        }
+
+        qvec4f *out = output.data() + static_cast<size_t>(y) * outw;
 
-            const int outIndex = (y * outw) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
+        for (int x = 0; x < outw; x++) {
+            if (totals[x][3] > 0.0f) {
+                const qvec3f tmp = qvec3f(totals[x]) / totals[x][3];
+                out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
             } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
+                const qvec3f tmp = qvec3f(totalsIgnoringOcclusion[x]) / totalsIgnoringOcclusion[x][3];
+                out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
             }
         }
     }
-
-    return res;
 }
 
-static std::vector<qvec4f> FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
+void FloodFillTransparent(std::vector<qvec4f> &image, int w, int h)
 {
     // transparent pixels take the average of their neighbours.
+    //
+    // pixels are filled in place in raster order, so a pixel filled earlier in a
+    // pass counts as opaque for the ones after it. only the still-transparent
+    // pixels are revisited on the next pass.
 
-    std::vector<qvec4f> res(input);
-
-    while (1) {
-        int unhandled_pixels = 0;
-
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w; x++) {
-                const int i = (y * w) + x;
-                const qvec4f &inSample = res.at(i);
-
-                if (inSample[3] == 0) {
-                    // average the neighbouring non-transparent samples
-
-                    int opaque_neighbours = 0;
-                    qvec3f neighbours_sum{};
-                    for (int y0 = -1; y0 <= 1; y0++) {
-                        for (int x0 = -1; x0 <= 1; x0++) {
-                            const int x1 = x + x0;
-                            const int y1 = y + y0;
-
-                            if (x1 < 0 || x1 >= w)
-                                continue;
-                            if (y1 < 0 || y1 >= h)
-                                continue;
-
-                            const qvec4f neighbourSample = res.at((y1 * w) + x1);
-                            if (neighbourSample[3] == 1) {
-                                opaque_neighbours++;
-                                neighbours_sum += qvec3f(neighbourSample);
-                            }
-                        }
-                    }
+    thread_local std::vector<int> transparent;
+    transparent.clear();
+
+    for (int i = 0; i < w * h; i++) {
+        if (image[i][3] == 0) {
+            transparent.push_back(i);
+        }
+    }
+
+    if (transparent.empty()) {
+        return;
+    }
+
+    if (transparent.size() == image.size()) {
+        // logging::funcprint("warning, fully transparent lightmap\n");
+        fully_transparent_lightmaps++;
+        return;
+    }
+
+    while (!transparent.empty()) {
+        size_t unhandled_pixels = 0;
 
-                    if (opaque_neighbours > 0) {
-                        neighbours_sum *= (1.0f / (float)opaque_neighbours);
-                        res.at(i) = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
+        for (const int i : transparent) {
+            const int x = i % w;
+            const int y = i / w;
 
-                        // this sample is now opaque
-                    } else {
-                        unhandled_pixels++;
+            // average the neighbouring non-transparent samples
+            int opaque_neighbours = 0;
+            qvec3f neighbours_sum{};
 
-                        // all neighbours are transparent. need to perform more iterations (or the whole lightmap is
-                        // transparent).
+            for (int y1 = std::max(y - 1, 0); y1 <= std::min(y + 1, h - 1); y1++) {
+                for (int x1 = std::max(x - 1, 0); x1 <= std::min(x + 1, w - 1); x1++) {
+                    const qvec4f &neighbourSample = image[(y1 * w) + x1];
+                    if (neighbourSample[3] == 1) {
+                        opaque_neighbours++;
+                        neighbours_sum += qvec3f(neighbourSample);
                     }
                 }
             }
-        }
 
-        if (unhandled_pixels == input.size()) {
-            // logging::funcprint("warning, fully transparent lightmap\n");
-            fully_transparent_lightmaps++;
-            break;
+            if (opaque_neighbours > 0) {
+                neighbours_sum *= (1.0f / (float)opaque_neighbours);
+                image[i] = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
+
+                // this sample is now opaque
+            } else {
+                // all neighbours are transparent. need to perform more iterations.
+                transparent[unhandled_pixels++] = i;
+            }
         }
 
-        if (unhandled_pixels == 0)
-            break; // all done
+        transparent.resize(unhandled_pixels);
     }
-
-    return res;
 }
 
-static std::vector<qvec4f> HighlightSeams(const std::vector<qvec4f> &input, int w, int h)
+void HighlightSeams(std::vector<qvec4f> &image)
 {
-    std::vector<qvec4f> res(input);
-
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            const int i = (y * w) + x;
-            const qvec4f &inSample = res.at(i);
-
-            if (inSample[3] == 0) {
-                res.at(i) = qvec4f(255, 0, 0, 1);
-            }
+    for (qvec4f &sample : image) {
+        if (sample[3] == 0) {
+            sample = qvec4f(255, 0, 0, 1);
         }
     }
-
-    return res;
 }
 
-static std::vector<qvec4f> BoxBlurImage(const std::vector<qvec4f> &input, int w, int h, int radius)
+/*
+ * ============
+ * BoxBlurImage
+ *
+ * Box blur with clamped edges (see
+ * https://github.com/ericwa/ericw-tools/issues/171), done as two separable
+ * running-sum passes so the cost doesn't grow with the radius. Sums are kept
+ * in double; the result matches a direct 2D sum to float rounding.
+ * ============
+ */
+void BoxBlurImage(const std::vector<qvec4f> &input, std::vector<qvec4f> &output, int w, int h, int radius)
 {
-    std::vector<qvec4f> res(input.size());
+    // per pixel: the color sum of the non-occluded samples (weight in [3]), and of all samples
+    struct sums_t
+    {
+        qvec4d total, totalIgnoringOcclusion;
+    };
 
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
+    thread_local std::vector<sums_t> horizontal;
+    thread_local std::vector<sums_t> window;
 
-            float totalWeight = 0.0f;
-            qvec3f totalColor{};
+    horizontal.resize(input.size());
+    output.resize(input.size());
 
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion{};
+    auto sample_sums = [](const qvec4f &inSample) {
+        const qvec4d sample{inSample[0], inSample[1], inSample[2], 1.0};
+        // Occluded sample points don't contribute to the filter
+        return sums_t{inSample[3] != 0.0f ? sample : qvec4d{}, sample};
+    };
 
-            for (int y0 = -radius; y0 <= radius; y0++) {
-                for (int x0 = -radius; x0 <= radius; x0++) {
-                    const int x1 = clamp(x + x0, 0, w - 1);
-                    const int y1 = clamp(y + y0, 0, h - 1);
+    // horizontal pass
+    for (int y = 0; y < h; y++) {
+        const qvec4f *row = input.data() + static_cast<size_t>(y) * w;
+        sums_t *out = horizontal.data() + static_cast<size_t>(y) * w;
+        sums_t sum{};
 
-                    // check if the kernel goes outside of the source image
+        for (int x0 = -radius; x0 <= radius; x0++) {
+            const sums_t s = sample_sums(row[clamp(x0, 0, w - 1)]);
+            sum.total += s.total;
+            sum.totalIgnoringOcclusion += s.totalIgnoringOcclusion;
+        }
 
-                    // 2017-09-16: this is a hack, but clamping the
-                    // x/y instead of discarding the samples outside of the
-                    // kernel looks better in some cases:
-                    // https://github.com/ericwa/ericw-tools/issues/171
-#if 0
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-#endif
+        for (int x = 0; x < w; x++) {
+            out[x] = sum;
 
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f &inSample = input.at((y1 * w) + x1);
+            const sums_t added = sample_sums(row[clamp(x + radius + 1, 0, w - 1)]);
+            const sums_t removed = sample_sums(row[clamp(x - radius, 0, w - 1)]);
+            sum.total += added.total - removed.total;
+            sum.totalIgnoringOcclusion += added.totalIgnoringOcclusion - removed.totalIgnoringOcclusion;
+        }
+    }
 
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
+    // vertical pass, a whole row at a time
+    window.assign(w, {});
 
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
+    for (int y0 = -radius; y0 <= radius; y0++) {
+        const sums_t *row = horizontal.data() + static_cast<size_t>(clamp(y0, 0, h - 1)) * w;
 
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
-            }
+        for (int x = 0; x < w; x++) {
+            window[x].total += row[x].total;
+            window[x].totalIgnoringOcclusion += row[x].totalIgnoringOcclusion;
+        }
+    }
+
+    for (int y = 0; y < h; y++) {
+        qvec4f *out = output.data() + static_cast<size_t>(y) * w;
 
-            const int outIndex = (y * w) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
+        for (int x = 0; x < w; x++) {
+            const sums_t &sum = window[x];
+
+            if (sum.total[3] > 0.0) {
+                const qvec3d tmp = qvec3d(sum.total) / sum.total[3];
+                out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
             } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
+                const qvec3d tmp = qvec3d(sum.totalIgnoringOcclusion) / sum.totalIgnoringOcclusion[3];
+                out[x] = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
             }
         }
-    }
 
-    return res;
+        const sums_t *added = horizontal.data() + static_cast<size_t>(clamp(y + radius + 1, 0, h - 1)) * w;
+        const sums_t *removed = horizontal.data() + static_cast<size_t>(clamp(y - radius, 0, h - 1)) * w;
+
+        for (int x = 0; x < w; x++) {
+            window[x].total += added[x].total - removed[x].total;
+            window[x].totalIgnoringOcclusion += added[x].totalIgnoringOcclusion - removed[x].totalIgnoringOcclusion;
+        }
+    }
 }
 
 bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face)
@@ -2509,29 +2847,29 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
     const int oversampled_width = actual_width * light_options.extra.value();
     const int oversampled_height = actual_height * light_options.extra.value();
 
-    // allocate new float buffers for the output colors and directions
-    // these are the actual output width*height, without oversampling.
+    // float buffers for the output colors and directions, reused between calls on this thread.
+    // output_color/output_dir are the actual output width*height, without oversampling.
+    thread_local std::vector<qvec4f> fullres, blurred, output_color, output_dir;
 
-    std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
+    LightmapColorsToGLMVector(lightsurf, lm, fullres);
 
     if (light_options.highlightseams.value()) {
-        fullres = HighlightSeams(fullres, oversampled_width, oversampled_height);
+        HighlightSeams(fullres);
     }
 
     // removes all transparent pixels by averaging from adjacent pixels
-    fullres = FloodFillTransparent(fullres, oversampled_width, oversampled_height);
+    FloodFillTransparent(fullres, oversampled_width, oversampled_height);
 
     if (light_options.soft.value() > 0) {
-        fullres = BoxBlurImage(fullres, oversampled_width, oversampled_height, light_options.soft.value());
+        BoxBlurImage(fullres, blurred, oversampled_width, oversampled_height, light_options.soft.value());
+        std::swap(fullres, blurred);
     }
 
-    const std::vector<qvec4f> output_color =
-        IntegerDownsampleImage(fullres, oversampled_width, oversampled_height, light_options.extra.value());
-    std::optional<std::vector<qvec4f>> output_dir;
+    IntegerDownsampleImage(fullres, output_color, oversampled_width, oversampled_height, light_options.extra.value());
 
     if (lux) {
-        output_dir = IntegerDownsampleImage(LightmapNormalsToGLMVector(lightsurf, lm), oversampled_width,
-            oversampled_height, light_options.extra.value());
+        LightmapNormalsToGLMVector(lightsurf, lm, fullres);
+        IntegerDownsampleImage(fullres, output_dir, oversampled_width, oversampled_height, light_options.extra.value());
     }
 
     // copy from the float buffers to byte buffers in .bsp / .lit / .lux
@@ -2571,7 +2909,7 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
             }
 
             if (lux) {
-                qvec3d direction = output_dir->at(sampleindex).xyz();
+                qvec3d direction = output_dir.at(sampleindex).xyz();
                 qvec3d temp = {qv::dot(direction, lightsurf->snormal), qv::dot(direction, lightsurf->tnormal),
                     qv::dot(direction, lightsurf->plane.normal)};
 
@@ -2600,7 +2938,8 @@ static void WriteSingleLightmap_FromDecoupled(const mbsp_t *bsp, const mface_t *
     const lightmap_t *lm, const int output_width, const int output_height, uint8_t *out, uint8_t *lit, uint8_t *lux)
 {
     // this is the lightmap data in the "decoupled" coordinate system
-    std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
+    std::vector<qvec4f> fullres;
+    LightmapColorsToGLMVector(lightsurf, lm, fullres);
 
     // maps a luxel in the vanilla lightmap to the corresponding position in the decoupled lightmap
     const qmat4x4f vanillaLMToDecoupled = lightsurf->extents.worldToLMMatrix * lightsurf->vanilla_extents.lmToWorldMatrix;
@@ -2995,7 +3334,7 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
 
             // mxd. Add surface lights...
             // FIXME: negative surface lights
-            LightFace_SurfaceLight(bsp, &lightsurf, lightmaps, GetSurfaceLights(), cfg.surflightscale.value(), cfg.surflightskyscale.value(), 16.0f);
+            LightFace_SurfaceLight(bsp, &lightsurf, lightmaps, GetSurfaceLights(), GetSurfaceLightTree(), cfg.surflightscale.value(), cfg.surflightskyscale.value(), 16.0f);
         }
 
         float minlight = 0;
@@ -3076,7 +3415,7 @@ void IndirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings
 
             /* add bounce lighting */
             // note: scale here is just to keep it close-ish to the old code
-            LightFace_SurfaceLight(bsp, &lightsurf, lightmaps, BounceLights(), cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(), 128.0f);
+            LightFace_SurfaceLight(bsp, &lightsurf, lightmaps, BounceLights(), BounceLightTree(), cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(), 128.0f);
         }
     }
 }
@@ -3096,4 +3435,6 @@ void ResetLtFace()
 
     warned_about_light_map_overflow = false;
     warned_about_light_style_overflow = false;
+
+    leaf_pvs_cache = {};
 }
@@ -31,9 +31,11 @@
 #include <unordered_map>
 #include <set>
 #include <algorithm>
-#include <mutex>
+#include <atomic>
+#include <span>
 
 #include <common/qvec.hh>
+#include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 
 using namespace std;
@@ -174,11 +176,28 @@ static float AngleBetweenPoints(const qvec3f &p1, const qvec3f &p2, const qvec3f
     return result;
 }
 
+/*
+ * compressed sparse row adjacency: the values of row `i` are
+ * values[offsets[i] .. offsets[i + 1]), sorted by face number
+ */
+struct face_adjacency_t
+{
+    std::vector<size_t> offsets;
+    std::vector<const mface_t *> values;
+
+    std::span<const mface_t *const> row(size_t i) const
+    {
+        if (i + 1 >= offsets.size())
+            return {};
+        return {values.data() + offsets[i], offsets[i + 1] - offsets[i]};
+    }
+};
+
 static bool s_builtPhongCaches;
-static std::unordered_map<const mface_t *, std::vector<face_normal_t>> vertex_normals;
-static map<const mface_t *, set<const mface_t *>> smoothFaces;
-static map<int, vector<const mface_t *>> vertsToFaces;
-static map<int, vector<const mface_t *>> planesToFaces;
+static std::vector<std::vector<face_normal_t>> vertex_normals; // indexed by face number
+static face_adjacency_t smoothFaces; // face number -> faces to smooth with
+static face_adjacency_t vertsToFaces; // vertex number -> faces using it
+static face_adjacency_t planesToFaces; // plane number -> faces on it
 static edgeToFaceMap_t EdgeToFaceMap;
 static vector<face_cache_t> FaceCache;
 
@@ -193,14 +212,9 @@ void ResetPhong()
     FaceCache = {};
 }
 
-vector<const mface_t *> FacesUsingVert(int vertnum)
+std::span<const mface_t *const> FacesUsingVert(int vertnum)
 {
-    const auto &vertsToFaces_const = vertsToFaces;
-
-    auto it = vertsToFaces_const.find(vertnum);
-    if (it != vertsToFaces_const.end())
-        return it->second;
-    return {};
+    return vertsToFaces.row(vertnum);
 }
 
 const edgeToFaceMap_t &GetEdgeToFaceMap()
@@ -210,45 +224,26 @@ const edgeToFaceMap_t &GetEdgeToFaceMap()
 }
 
 // Uses `smoothFaces` static var
-bool FacesSmoothed(const mface_t *f1, const mface_t *f2)
+bool FacesSmoothed(const mbsp_t *bsp, const mface_t *f1, const mface_t *f2)
 {
     Q_assert(s_builtPhongCaches);
 
-    const auto &facesIt = smoothFaces.find(f1);
-    if (facesIt == smoothFaces.end())
-        return false;
-
-    const set<const mface_t *> &faceSet = facesIt->second;
-    if (faceSet.find(f2) == faceSet.end())
-        return false;
-
-    return true;
+    const auto faces = smoothFaces.row(Face_GetNum(bsp, f1));
+    return std::binary_search(faces.begin(), faces.end(), f2);
 }
 
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face)
+std::span<const mface_t *const> GetSmoothFaces(const mbsp_t *bsp, const mface_t *face)
 {
     Q_assert(s_builtPhongCaches);
 
-    static std::set<const mface_t *> empty;
-    const auto it = smoothFaces.find(face);
-
-    if (it == smoothFaces.end())
-        return empty;
-
-    return it->second;
+    return smoothFaces.row(Face_GetNum(bsp, face));
 }
 
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face)
+std::span<const mface_t *const> GetPlaneFaces(const mface_t *face)
 {
     Q_assert(s_builtPhongCaches);
 
-    static std::vector<const mface_t *> empty;
-    const auto it = planesToFaces.find(face->planenum);
-
-    if (it == planesToFaces.end())
-        return empty;
-
-    return it->second;
+    return planesToFaces.row(face->planenum);
 }
 
 // Adapted from https://github.com/NVIDIAGameWorks/donut/blob/main/src/engine/GltfImporter.cpp#L684
@@ -274,13 +269,12 @@ const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f,
     Q_assert(s_builtPhongCaches);
 
     // handle degenerate faces
-    const auto it = vertex_normals.find(f);
-    if (it == vertex_normals.end()) {
+    const size_t fnum = Face_GetNum(bsp, f);
+    if (fnum >= vertex_normals.size() || vertex_normals[fnum].empty()) {
         static const face_normal_t empty{};
         return empty;
     }
-    const auto &face_normals_vec = it->second;
-    return face_normals_vec.at(vertindex);
+    return vertex_normals[fnum].at(vertindex);
 }
 
 const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex)
@@ -301,7 +295,7 @@ const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const
             const bool sameplane = (neighbour->planenum == f->planenum && neighbour->side == f->side);
 
             // Check if these faces are smoothed or on the same plane
-            if (!(FacesSmoothed(f, neighbour) || sameplane)) {
+            if (!(FacesSmoothed(bsp, f, neighbour) || sameplane)) {
                 continue;
             }
 
@@ -309,30 +303,6 @@ const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const
         }
     }
     return nullptr;
-
-#if 0
-    if (smoothFaces.find(f) == smoothFaces.end()) {
-        return nullptr;
-    }
-    
-    int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
-    int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
-    
-    const auto &v0_faces = vertsToFaces.at(v0);
-    const auto &v1_faces = vertsToFaces.at(v1);
-    
-    // find a face f2 that has both verts v0 and v1
-    for (auto f2 : v0_faces) {
-        if (f2 == f)
-            continue;
-        if (find(v1_faces.begin(), v1_faces.end(), f2) != v1_faces.end()) {
-            const auto &f_smoothfaces = smoothFaces.at(f);
-            bool smoothed = (f_smoothfaces.find(f2) != f_smoothfaces.end());
-            return smoothed ? f2 : nullptr;
-        }
-    }
-    return nullptr;
-#endif
 }
 
 static edgeToFaceMap_t MakeEdgeToFaceMap(const mbsp_t *bsp)
@@ -418,6 +388,99 @@ inline bool isDegenerate(const qvec3f &a, const qvec3f &b, const qvec3f &c)
     return false;
 }
 
+/*
+================
+MakeFaceAdjacency
+
+Builds a key -> faces adjacency in parallel. `keys(face, add)` calls `add(key)`
+for every key of the face; the faces of each key end up sorted by face number
+(with repeats if a face adds a key more than once).
+================
+*/
+template<typename KeysFn>
+static face_adjacency_t MakeFaceAdjacency(const mbsp_t *bsp, size_t numkeys, KeysFn keys)
+{
+    face_adjacency_t result;
+    std::vector<std::atomic<size_t>> counts(numkeys);
+
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        keys(bsp->dfaces[i], [&](size_t key) {
+            Q_assert(key < numkeys);
+            counts[key].fetch_add(1, std::memory_order_relaxed);
+        });
+    });
+
+    result.offsets.resize(numkeys + 1);
+    result.offsets[0] = 0;
+    for (size_t i = 0; i < numkeys; i++) {
+        result.offsets[i + 1] = result.offsets[i] + counts[i].load(std::memory_order_relaxed);
+        counts[i].store(result.offsets[i], std::memory_order_relaxed);
+    }
+
+    result.values.resize(result.offsets[numkeys]);
+
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        keys(bsp->dfaces[i], [&](size_t key) {
+            result.values[counts[key].fetch_add(1, std::memory_order_relaxed)] = &bsp->dfaces[i];
+        });
+    });
+
+    // the fill order above depends on thread timing; sort each row so it doesn't
+    tbb::parallel_for(static_cast<size_t>(0), numkeys, [&](size_t i) {
+        std::sort(result.values.begin() + result.offsets[i], result.values.begin() + result.offsets[i + 1]);
+    });
+
+    return result;
+}
+
+// the phong settings of a face, plus the geometry the smoothing needs from it
+struct face_phong_t
+{
+    int phong_value; // Q2 shading group
+    vec_t phong_angle, phong_angle_concave;
+    bool wants_phong;
+    const mtexinfo_t *texinfo;
+    qvec3d norm;
+    qplane3d plane;
+    qvec3f centroid;
+    float area;
+    std::tuple<qvec3f, qvec3f> tangents;
+};
+
+static face_phong_t MakeFacePhong(const mbsp_t *bsp, const mface_t *f)
+{
+    face_phong_t result{};
+
+    // Q2 shading groups
+    result.phong_value = Q2_FacePhongValue(bsp, f);
+
+    // any face normal within this many degrees can be smoothed with this face
+    result.phong_angle = extended_texinfo_flags[f->texinfo].phong_angle;
+    if (result.phong_angle == 0 && result.phong_value != 0) {
+        // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
+        result.phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
+    }
+    result.phong_angle_concave = extended_texinfo_flags[f->texinfo].phong_angle_concave;
+    if (result.phong_angle_concave == 0) {
+        result.phong_angle_concave = result.phong_angle;
+    }
+    result.wants_phong = (result.phong_angle || result.phong_angle_concave) &&
+                         !extended_texinfo_flags[f->texinfo].no_phong;
+
+    result.texinfo = Face_Texinfo(bsp, f);
+    result.norm = Face_Normal(bsp, f);
+    result.plane = Face_Plane(bsp, f);
+
+    const auto points = GLM_FacePoints(bsp, f);
+    result.centroid = qv::PolyCentroid(points.begin(), points.end());
+    result.area = qv::PolyArea(points.begin(), points.end());
+
+    auto t = TexSpaceToWorld(bsp, f);
+    result.tangents = {t.col(0).xyz(), qv::normalize(t.col(1).xyz())};
+
+    return result;
+}
+
 void CalculateVertexNormals(const mbsp_t *bsp)
 {
     logging::funcheader();
@@ -443,111 +506,99 @@ void CalculateVertexNormals(const mbsp_t *bsp)
         }
     }
 
-    for (auto &f : bsp->dfaces) {
-        // build "plane -> faces" map
-        planesToFaces[f.planenum].push_back(&f);
+    const size_t numfaces = bsp->dfaces.size();
 
-        // build "vert index -> faces" map
+    // build "vert index -> faces" and "plane -> faces" maps
+    vertsToFaces = MakeFaceAdjacency(bsp, bsp->dvertexes.size(), [bsp](const mface_t &f, auto &&add) {
         for (size_t j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            vertsToFaces[v].push_back(&f);
+            add(Face_VertexAtIndex(bsp, &f, j));
         }
-    }
+    });
+    planesToFaces = MakeFaceAdjacency(bsp, bsp->dplanes.size(), [](const mface_t &f, auto &&add) {
+        add(f.planenum);
+    });
+
+    // per-face phong parameters, so the neighbour tests below don't recompute them
+    std::vector<face_phong_t> phong(numfaces);
+    tbb::parallel_for(static_cast<size_t>(0), numfaces, [&](size_t i) {
+        phong[i] = MakeFacePhong(bsp, &bsp->dfaces[i]);
+    });
 
     // build the "face -> faces to smooth with" map
-    for (auto &f : bsp->dfaces) {
-        // Q2 shading groups
-        const int f_phongValue = Q2_FacePhongValue(bsp, &f);
-
-        // Q1 phong angle stuff
-        auto *f_texinfo = Face_Texinfo(bsp, &f);
-        const auto f_points = GLM_FacePoints(bsp, &f);
-        const qvec3d f_norm = Face_Normal(bsp, &f);
-        const qplane3d f_plane = Face_Plane(bsp, &f);
-
-        // any face normal within this many degrees can be smoothed with this face
-        vec_t f_phong_angle = extended_texinfo_flags[f.texinfo].phong_angle;
-        if (f_phong_angle == 0 && f_phongValue != 0) {
-            // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-            f_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-        }
-        vec_t f_phong_angle_concave = extended_texinfo_flags[f.texinfo].phong_angle_concave;
-        if (f_phong_angle_concave == 0) {
-            f_phong_angle_concave = f_phong_angle;
-        }
-        const bool f_wants_phong = (f_phong_angle || f_phong_angle_concave);
+    std::vector<std::vector<const mface_t *>> smoothRows(numfaces);
+    tbb::parallel_for(static_cast<size_t>(0), numfaces, [&](size_t i) {
+        const mface_t &f = bsp->dfaces[i];
+        const face_phong_t &fp = phong[i];
 
-        if (!f_wants_phong)
-            continue;
+        if (!fp.wants_phong)
+            return;
 
-        if (extended_texinfo_flags[f.texinfo].no_phong)
-            continue;
+        auto &row = smoothRows[i];
 
         for (int j = 0; j < f.numedges; j++) {
             const int v = Face_VertexAtIndex(bsp, &f, j);
             // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
-            for (const mface_t *f2 : vertsToFaces[v]) {
+            for (const mface_t *f2 : vertsToFaces.row(v)) {
                 if (f2 == &f)
                     continue;
 
-                // FIXME: factor out and share with above?
-                const int f2_phongValue = Q2_FacePhongValue(bsp, f2);
-                vec_t f2_phong_angle = extended_texinfo_flags[f2->texinfo].phong_angle;
-                if (f2_phong_angle == 0 && f2_phongValue != 0) {
-                    // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-                    f2_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-                }
-                vec_t f2_phong_angle_concave = extended_texinfo_flags[f2->texinfo].phong_angle_concave;
-                if (f2_phong_angle_concave == 0) {
-                    f2_phong_angle_concave = f2_phong_angle;
-                }
-                const bool f2_wants_phong = (f2_phong_angle || f2_phong_angle_concave);
+                const face_phong_t &f2p = phong[f2 - bsp->dfaces.data()];
 
-                if (!f2_wants_phong)
+                if (!f2p.wants_phong)
                     continue;
 
-                if (extended_texinfo_flags[f2->texinfo].no_phong)
-                    continue;
-
-                auto *f2_texinfo = Face_Texinfo(bsp, f2);
-                if (f2_texinfo != nullptr && f_texinfo != nullptr) {
-                    if (!bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags)) {
+                if (f2p.texinfo != nullptr && fp.texinfo != nullptr) {
+                    if (!bsp->loadversion->game->surfflags_may_phong(fp.texinfo->flags, f2p.texinfo->flags)) {
                         // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
                         continue;
                     }
                 }
 
-                const auto f2_points = GLM_FacePoints(bsp, f2);
-                const qvec3f f2_centroid = qv::PolyCentroid(f2_points.begin(), f2_points.end());
-                const qvec3d f2_norm = Face_Normal(bsp, f2);
-
-                const vec_t cosangle = qv::dot(f_norm, f2_norm);
+                const vec_t cosangle = qv::dot(fp.norm, f2p.norm);
 
-                const bool concave = f_plane.dist_above(f2_centroid) > 0.1;
-                const vec_t f_threshold = concave ? f_phong_angle_concave : f_phong_angle;
-                const vec_t f2_threshold = concave ? f2_phong_angle_concave : f2_phong_angle;
+                const bool concave = fp.plane.dist_above(f2p.centroid) > 0.1;
+                const vec_t f_threshold = concave ? fp.phong_angle_concave : fp.phong_angle;
+                const vec_t f2_threshold = concave ? f2p.phong_angle_concave : f2p.phong_angle;
                 const vec_t min_threshold = min(f_threshold, f2_threshold);
                 const vec_t cosmaxangle = cos(DEG2RAD(min_threshold));
 
-                if (f_phongValue != f2_phongValue) {
+                if (fp.phong_value != f2p.phong_value) {
                     // mismatched smoothing groups never phong
                     continue;
                 }
 
                 // check the angle between the face normals
                 if (cosangle >= cosmaxangle) {
-                    smoothFaces[&f].insert(f2);
+                    row.push_back(f2);
                 }
             }
         }
+
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+    });
+
+    size_t numSmoothFaces = 0;
+    smoothFaces.offsets.resize(numfaces + 1);
+    smoothFaces.offsets[0] = 0;
+    for (size_t i = 0; i < numfaces; i++) {
+        numSmoothFaces += !smoothRows[i].empty();
+        smoothFaces.offsets[i + 1] = smoothFaces.offsets[i] + smoothRows[i].size();
     }
+    smoothFaces.values.resize(smoothFaces.offsets[numfaces]);
+    tbb::parallel_for(static_cast<size_t>(0), numfaces, [&](size_t i) {
+        std::copy(smoothRows[i].begin(), smoothRows[i].end(), smoothFaces.values.begin() + smoothFaces.offsets[i]);
+    });
+    smoothRows = {};
+
+    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n", numSmoothFaces);
 
-    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n", smoothFaces.size());
+    // finally do the smoothing for each face; each face only writes its own slot
+    vertex_normals.resize(numfaces);
 
-    // finally do the smoothing for each face
-    std::mutex normalsMutex;
+    logging::parallel_for(static_cast<size_t>(0), numfaces, [bsp, &phong](size_t i) {
+        const mface_t &f = bsp->dfaces[i];
 
-    logging::parallel_for_each(bsp->dfaces, [bsp, &normalsMutex](const mface_t &f) {
         if (f.numedges < 3) {
             logging::funcprint("face {} is degenerate with {} edges\n", Face_GetNum(bsp, &f), f.numedges);
             for (int j = 0; j < f.numedges; j++) {
@@ -559,36 +610,45 @@ void CalculateVertexNormals(const mbsp_t *bsp)
         const qvec3f f_norm = Face_Normal(bsp, &f); // get the face normal
 
         // face tangent
-        auto t1 = TexSpaceToWorld(bsp, &f);
-        std::tuple<qvec3f, qvec3f> tangents(t1.col(0).xyz(), qv::normalize(t1.col(1).xyz()));
+        const std::tuple<qvec3f, qvec3f> &tangents = phong[i].tangents;
 
         // gather up f and neighboursToSmooth
+        const auto neighboursToSmooth = smoothFaces.row(i);
         std::vector<const mface_t *> fPlusNeighbours;
+        fPlusNeighbours.reserve(neighboursToSmooth.size() + 1);
         fPlusNeighbours.push_back(&f);
-        auto neighboursIt = smoothFaces.find(&f);
+        std::copy(neighboursToSmooth.begin(), neighboursToSmooth.end(), std::back_inserter(fPlusNeighbours));
 
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            std::copy(neighboursToSmooth.begin(), neighboursToSmooth.end(), std::back_inserter(fPlusNeighbours));
+        // the vertices of `f` and their smoothed normals; contributions to
+        // vertices not on `f` are never read, so they're skipped
+        std::vector<int> f_verts;
+        f_verts.reserve(f.numedges);
+        for (int j = 0; j < f.numedges; j++) {
+            const int v = Face_VertexAtIndex(bsp, &f, j);
+            if (std::find(f_verts.begin(), f_verts.end(), v) == f_verts.end()) {
+                f_verts.push_back(v);
+            }
         }
-
-        // global vertex index -> smoothed normal
-        std::unordered_map<int, face_normal_t> smoothedNormals;
+        std::vector<face_normal_t> smoothedNormals(f_verts.size());
 
         // walk fPlusNeighbours
         for (auto f2 : fPlusNeighbours) {
-            const auto f2_poly = GLM_FacePoints(bsp, f2);
-            const float f2_area = qv::PolyArea(f2_poly.begin(), f2_poly.end());
-            const qvec3f f2_norm = Face_Normal(bsp, f2);
+            const face_phong_t &f2p = phong[f2 - bsp->dfaces.data()];
+            const float f2_area = f2p.area;
+            const qvec3f f2_norm = f2p.norm;
 
             // f2 face tangent
-            auto t2 = TexSpaceToWorld(bsp, f2);
-            std::tuple<qvec3f, qvec3f> f2_tangents(t2.col(0).xyz(), qv::normalize(t2.col(1).xyz()));
+            const std::tuple<qvec3f, qvec3f> &f2_tangents = f2p.tangents;
 
             // walk the vertices of f2, and add their contribution to smoothedNormals
             for (int j = 0; j < f2->numedges; j++) {
-                const int prev_vert_num = Face_VertexAtIndex(bsp, f2, ((j - 1) + f2->numedges) % f2->numedges);
                 const int curr_vert_num = Face_VertexAtIndex(bsp, f2, j);
+                const auto vert_it = std::find(f_verts.begin(), f_verts.end(), curr_vert_num);
+
+                if (vert_it == f_verts.end())
+                    continue;
+
+                const int prev_vert_num = Face_VertexAtIndex(bsp, f2, ((j - 1) + f2->numedges) % f2->numedges);
                 const int next_vert_num = Face_VertexAtIndex(bsp, f2, (j + 1) % f2->numedges);
 
                 const qvec3f &prev_vert_pos = Vertex_GetPos(bsp, prev_vert_num);
@@ -603,28 +663,19 @@ void CalculateVertexNormals(const mbsp_t *bsp)
                     weight = 0;
                 }
 
-                auto &n = smoothedNormals[curr_vert_num];
+                auto &n = smoothedNormals[vert_it - f_verts.begin()];
                 n.normal += f2_norm * weight;
                 n.tangent += std::get<0>(f2_tangents) * weight;
                 n.bitangent += std::get<1>(f2_tangents) * weight;
             }
         }
 
-        // normalize vertex normals (NOTE: updates smoothedNormals map)
-        for (auto &pair : smoothedNormals) {
-            face_normal_t &vertNormal = pair.second;
+        // normalize vertex normals (NOTE: updates smoothedNormals)
+        for (face_normal_t &vertNormal : smoothedNormals) {
             if (0 == qv::length(vertNormal.normal)) {
                 // this happens when there are colinear vertices, which give zero-area triangles,
                 // so there is no contribution to the normal of the triangle in the middle of the
                 // line. Not really an error, just set it to use the face normal.
-#if 0
-                const int vertIndex = pair.first;
-                logging::print("Failed to calculate normal for vertex {} at ({} {} {})\n",
-                         vertIndex,
-                         bsp->dvertexes[vertIndex].point[0],
-                         bsp->dvertexes[vertIndex].point[1],
-                         bsp->dvertexes[vertIndex].point[2]);
-#endif
                 vertNormal = {f_norm, std::get<0>(tangents), std::get<1>(tangents)};
             } else {
                 vertNormal = {qv::normalize(vertNormal.normal), qv::normalize(vertNormal.tangent),
@@ -646,24 +697,13 @@ void CalculateVertexNormals(const mbsp_t *bsp)
             }
         }
 
-        // sanity check
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            if (!neighboursToSmooth.size()) {
-                for (auto &vertIndexNormalPair : smoothedNormals) {
-                    Q_assert(qv::epsilonEqual(vertIndexNormalPair.second.normal, f_norm, (float)LIGHT_EQUAL_EPSILON));
-                }
-            }
-        }
-
         // now, record all of the smoothed normals that are actually part of `f`
-        for (int j = 0; j < f.numedges; j++) {
-            int v = Face_VertexAtIndex(bsp, &f, j);
-            Q_assert(smoothedNormals.find(v) != smoothedNormals.end());
+        auto &normals = vertex_normals[i];
+        normals.reserve(f.numedges);
 
-            normalsMutex.lock();
-            vertex_normals[&f].push_back(smoothedNormals[v]);
-            normalsMutex.unlock();
+        for (int j = 0; j < f.numedges; j++) {
+            const int v = Face_VertexAtIndex(bsp, &f, j);
+            normals.push_back(smoothedNormals[std::find(f_verts.begin(), f_verts.end(), v) - f_verts.begin()]);
         }
     });
 
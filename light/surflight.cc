@@ -28,25 +28,30 @@ See file, 'COPYING', for details.
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
 
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <map>
-#include <mutex>
 
 #include <common/qvec.hh>
 
 using namespace std;
 using namespace polylib;
 
-static mutex surfacelights_lock;
 static std::vector<surfacelight_t> surfacelights;
-static std::map<int, std::vector<int>> surfacelightsByFacenum;
+// CSR map from face number to the surface lights it's part of
+static std::vector<int> surfacelights_face_offsets;
+static std::vector<int> surfacelights_by_face;
+static surfacelight_tree_t surfacelighttree;
 static size_t total_surflight_points = 0;
 
 void ResetSurflight()
 {
     surfacelights = {};
-    surfacelightsByFacenum = {};
-    total_surflight_points = {};
+    surfacelighttree = {};
+    surfacelights_face_offsets = {};
+    surfacelights_by_face = {};
+    total_surflight_points = 0;
 }
 
 std::vector<surfacelight_t> &GetSurfaceLights()
@@ -54,8 +59,14 @@ std::vector<surfacelight_t> &GetSurfaceLights()
     return surfacelights;
 }
 
-static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, const mface_t *face,
-    std::optional<qvec3f> texture_color, bool is_directional, bool is_sky, int32_t style, int32_t light_value)
+const surfacelight_tree_t &GetSurfaceLightTree()
+{
+    return surfacelighttree;
+}
+
+static void MakeSurfaceLightEmitter(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, const mface_t *face,
+    int32_t source, std::vector<surfacelight_emitter_t> &emitters, std::optional<qvec3f> texture_color,
+    bool is_directional, bool is_sky, int32_t style, int32_t light_value)
 {
     // Create face points...
     auto poly = GLM_FacePoints(bsp, face);
@@ -75,12 +86,6 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
     qvec3d facenormal = Face_Normal(bsp, face);
     qvec3d facemidpoint = winding.center() + facenormal; // Lift 1 unit
 
-    // Dice winding...
-    vector<qvec3f> points;
-    winding.dice(cfg.surflightsubdivision.value(),
-        [&points, &facenormal](winding_t &w) { points.push_back(w.center() + facenormal); });
-    total_surflight_points += points.size();
-
     // Calculate emit color and intensity...
 
     // Handle arghrad sky light settings http://www.bspquakeeditor.com/arghrad/sunlight.html#sky
@@ -108,43 +113,25 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
     if (intensity > 1.0f)
         texture_color.value() *= 1.0f / intensity;
 
-    // Sanity checks...
-    Q_assert(!points.empty());
-
-    // Add surfacelight...
-    surfacelight_t l;
-    l.surfnormal = facenormal;
-    l.omnidirectional = !is_directional;
-    l.points = std::move(points);
-    l.style = style;
-    l.rescale = extended_flags.surflight_rescale;
-
-    // Init bbox...
-    if (light_options.visapprox.value() == visapprox_t::RAYS) {
-        l.bounds = EstimateVisibleBoundsAtPoint(facemidpoint);
+    surfacelight_emitter_t &e = emitters.emplace_back();
+    e.facenum = Face_GetNum(bsp, face);
+    e.source = source;
+    e.texinfo = face->texinfo;
+    e.planenum = face->planenum;
+    e.side = face->side;
+    e.model = ModelInfoForFace(bsp, e.facenum);
+    for (int v = 0; v < face->numedges; v++) {
+        e.vertices.push_back(Face_VertexAtIndex(bsp, face, v));
     }
-
-    for (auto &pt : l.points) {
-        if (light_options.visapprox.value() == visapprox_t::VIS) {
-            l.leaves.push_back(Light_PointInLeaf(bsp, pt));
-        } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
-            l.bounds += EstimateVisibleBoundsAtPoint(pt);
-        }
-    }
-
-    l.pos = facemidpoint;
-
-    // Store surfacelight settings...
-    l.totalintensity = intensity * facearea;
-    l.intensity = l.totalintensity / l.points.size();
-    l.color = texture_color.value();
-
-    // Store light...
-    unique_lock<mutex> lck{surfacelights_lock};
-    surfacelights.push_back(l);
-
-    const int index = static_cast<int>(surfacelights.size()) - 1;
-    surfacelightsByFacenum[Face_GetNum(bsp, face)].push_back(index);
+    e.winding = std::move(winding);
+    e.area = facearea;
+    e.normal = facenormal;
+    e.midpoint = facemidpoint;
+    e.color = texture_color.value();
+    e.intensity = intensity;
+    e.omnidirectional = !is_directional;
+    e.style = style;
+    e.rescale = extended_flags.surflight_rescale;
 }
 
 std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(const mbsp_t *bsp, const mface_t *face)
@@ -167,7 +154,8 @@ std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(
     return std::nullopt;
 }
 
-static void MakeSurfaceLightsThread(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, size_t i)
+static void MakeSurfaceLightEmittersThread(
+    const mbsp_t *bsp, const settings::worldspawn_keys &cfg, size_t i, std::vector<surfacelight_emitter_t> &emitters)
 {
     const mface_t *face = BSP_GetFace(bsp, i);
 
@@ -185,14 +173,18 @@ static void MakeSurfaceLightsThread(const mbsp_t *bsp, const settings::worldspaw
                         "WARNING: surface light '{}' at [{}] has 0 intensity.\n", Face_TextureName(bsp, face), wc);
                 }
             } else {
-                MakeSurfaceLight(bsp, cfg, face, std::nullopt, !(info->flags.native & Q2_SURF_SKY),
+                MakeSurfaceLightEmitter(bsp, cfg, face, -1, emitters, std::nullopt, !(info->flags.native & Q2_SURF_SKY),
                     (info->flags.native & Q2_SURF_SKY), 0, info->value);
             }
         }
     }
 
     // check matching templates
-    for (const auto &surflight : GetSurfaceLightTemplates()) {
+    const auto &templates = GetSurfaceLightTemplates();
+
+    for (size_t t = 0; t < templates.size(); t++) {
+        const auto &surflight = templates[t];
+
         if (FaceMatchesSurfaceLightTemplate(bsp, face, ModelInfoForFace(bsp, face - bsp->dfaces.data()), *surflight, SURFLIGHT_RAD)) {
             std::optional<qvec3f> texture_color;
 
@@ -200,7 +192,7 @@ static void MakeSurfaceLightsThread(const mbsp_t *bsp, const settings::worldspaw
                 texture_color = surflight->color.value();
             }
 
-            MakeSurfaceLight(bsp, cfg, face, texture_color,
+            MakeSurfaceLightEmitter(bsp, cfg, face, static_cast<int32_t>(t), emitters, texture_color,
                 !surflight->epairs->has("_surface_spotlight") ? true
                                                               : !!surflight->epairs->get_int("_surface_spotlight"),
                 surflight->epairs->get_int("_surface_is_sky"), surflight->epairs->get_int("style"),
@@ -209,15 +201,298 @@ static void MakeSurfaceLightsThread(const mbsp_t *bsp, const settings::worldspaw
     }
 }
 
+static int32_t FindEmitterGroup(std::vector<int32_t> &parent, int32_t i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+/*
+ * Groups emitters that can share one light: same source, texinfo, plane, style
+ * and model, and connected through shared vertices. Returns the emitter indices
+ * of each group; groups are ordered by their first emitter.
+ */
+std::vector<std::vector<int32_t>> GroupSurfaceLightEmitters(const std::vector<surfacelight_emitter_t> &emitters)
+{
+    using emitter_key_t = std::tuple<int32_t, int32_t, int64_t, int32_t, int32_t, const modelinfo_t *>;
+
+    std::map<emitter_key_t, int32_t> classes;
+    std::map<std::pair<int32_t, int32_t>, int32_t> vertex_owner;
+    std::vector<int32_t> parent(emitters.size());
+
+    for (size_t i = 0; i < emitters.size(); i++) {
+        const surfacelight_emitter_t &e = emitters[i];
+        const emitter_key_t key{e.source, e.texinfo, e.planenum, e.side, e.style, e.model};
+        const int32_t cls = classes.emplace(key, static_cast<int32_t>(classes.size())).first->second;
+
+        parent[i] = static_cast<int32_t>(i);
+
+        for (int32_t v : e.vertices) {
+            auto [it, inserted] = vertex_owner.emplace(std::make_pair(cls, v), static_cast<int32_t>(i));
+
+            if (!inserted) {
+                const int32_t a = FindEmitterGroup(parent, it->second);
+                const int32_t b = FindEmitterGroup(parent, static_cast<int32_t>(i));
+
+                // the lower index is the root, so a group's root is its first emitter
+                parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    std::vector<std::vector<int32_t>> groups;
+    std::vector<int32_t> group_of_root(emitters.size(), -1);
+
+    for (size_t i = 0; i < emitters.size(); i++) {
+        const int32_t root = FindEmitterGroup(parent, static_cast<int32_t>(i));
+
+        if (group_of_root[root] == -1) {
+            group_of_root[root] = static_cast<int32_t>(groups.size());
+            groups.emplace_back();
+        }
+
+        groups[group_of_root[root]].push_back(static_cast<int32_t>(i));
+    }
+
+    return groups;
+}
+
+/*
+ * Dices a group of emitters into one light. Faces are diced on a world-aligned
+ * grid, so pieces of neighbouring faces that land in the same cell become one
+ * point, at their area weighted center.
+ */
+surfacelight_t MakeSurfaceLight(const settings::worldspawn_keys &cfg,
+    const std::vector<surfacelight_emitter_t> &emitters, const std::vector<int32_t> &group)
+{
+    const surfacelight_emitter_t &first = emitters[group.front()];
+    const vec_t subdiv = cfg.surflightsubdivision.value();
+
+    surfacelight_t l;
+    l.surfnormal = first.normal;
+    l.omnidirectional = first.omnidirectional;
+    l.style = first.style;
+    l.rescale = first.rescale;
+    l.color = first.color;
+
+    if (group.size() == 1) {
+        // nothing to merge
+        winding_t winding = first.winding.clone();
+        winding.dice(subdiv, [&](winding_t &w) { l.points.push_back(w.center() + first.normal); });
+
+        l.pos = first.midpoint;
+        l.totalintensity = first.intensity * first.area;
+    } else {
+        struct cell_t
+        {
+            qvec3d center_sum{};
+            vec_t area = 0;
+            qvec3d first_center;
+        };
+
+        std::map<std::array<int64_t, 3>, size_t> cell_index;
+        std::vector<cell_t> cells;
+        qvec3d midpoint_sum{};
+        vec_t total_area = 0;
+
+        for (int32_t index : group) {
+            const surfacelight_emitter_t &e = emitters[index];
+            winding_t winding = e.winding.clone();
+
+            winding.dice(subdiv, [&](winding_t &w) {
+                // bin by the point on the face; lifting it along a sloped normal
+                // first could move two pieces of one face into the same cell
+                const qvec3d on_face = w.center();
+                const std::array<int64_t, 3> key{static_cast<int64_t>(floor(on_face[0] / subdiv)),
+                    static_cast<int64_t>(floor(on_face[1] / subdiv)), static_cast<int64_t>(floor(on_face[2] / subdiv))};
+                const qvec3d center = on_face + e.normal;
+                auto [it, inserted] = cell_index.emplace(key, cells.size());
+
+                if (inserted) {
+                    cells.push_back({{}, 0, center});
+                }
+
+                const vec_t area = w.area();
+                cells[it->second].center_sum += center * area;
+                cells[it->second].area += area;
+            });
+
+            midpoint_sum += e.midpoint * e.area;
+            total_area += e.area;
+        }
+
+        l.points.reserve(cells.size());
+
+        for (const cell_t &cell : cells) {
+            l.points.push_back(cell.area > 0 ? cell.center_sum / cell.area : cell.first_center);
+        }
+
+        l.pos = midpoint_sum / total_area;
+        l.totalintensity = first.intensity * total_area;
+    }
+
+    // Sanity checks...
+    Q_assert(!l.points.empty());
+
+    // Store surfacelight settings...
+    l.intensity = l.totalintensity / l.points.size();
+
+    // Init bbox...
+    if (light_options.visapprox.value() == visapprox_t::RAYS) {
+        l.bounds = EstimateVisibleBoundsAtPoint(l.pos);
+    }
+
+    return l;
+}
+
+/*
+ * Fills in each light's per-point leafs (or estimated visible bounds), as one
+ * batch over every point of every light.
+ */
+static void FindSurfaceLightLeaves(const mbsp_t *bsp, std::vector<surfacelight_t> &lights)
+{
+    const visapprox_t visapprox = light_options.visapprox.value();
+
+    if (visapprox != visapprox_t::VIS && visapprox != visapprox_t::RAYS) {
+        return;
+    }
+
+    std::vector<size_t> first_point(lights.size() + 1);
+
+    for (size_t i = 0; i < lights.size(); i++) {
+        first_point[i + 1] = first_point[i] + lights[i].points.size();
+
+        if (visapprox == visapprox_t::VIS) {
+            lights[i].leaves.resize(lights[i].points.size());
+        }
+    }
+
+    std::vector<aabb3d> point_bounds(visapprox == visapprox_t::RAYS ? first_point.back() : 0);
+
+    logging::parallel_for(static_cast<size_t>(0), first_point.back(), [&](size_t p) {
+        const size_t i = std::upper_bound(first_point.begin(), first_point.end(), p) - first_point.begin() - 1;
+        surfacelight_t &l = lights[i];
+        const qvec3f &pt = l.points[p - first_point[i]];
+
+        if (visapprox == visapprox_t::VIS) {
+            l.leaves[p - first_point[i]] = Light_PointInLeaf(bsp, pt);
+        } else {
+            point_bounds[p] = EstimateVisibleBoundsAtPoint(pt);
+        }
+    });
+
+    if (visapprox == visapprox_t::RAYS) {
+        for (size_t i = 0; i < lights.size(); i++) {
+            for (size_t p = first_point[i]; p < first_point[i + 1]; p++) {
+                lights[i].bounds += point_bounds[p];
+            }
+        }
+    }
+}
+
+/*
+ * Builds the subtree over lights[order[first..last)]; returns the node index.
+ * Splits at the median of the longest axis of the lights' positions.
+ */
+static int32_t MakeSurfaceLightTree_r(surfacelight_tree_t &tree, const std::vector<surfacelight_t> &lights,
+    std::vector<int32_t> &order, size_t first, size_t last)
+{
+    surfacelight_tree_node_t node;
+    qvec3d normal_sum{};
+    bool omnidirectional = false;
+    float brightest = -1;
+
+    for (size_t i = first; i < last; i++) {
+        const surfacelight_t &l = lights[order[i]];
+        const qvec3f power = qvec3f(l.color) * l.totalintensity;
+        auto &max_power = node.max_power[l.omnidirectional];
+
+        for (auto &pt : l.points) {
+            node.bounds += pt;
+        }
+        node.pos_bounds += l.pos;
+        node.vis_bounds += l.bounds;
+
+        max_power = qv::max(max_power, power);
+        node.total_power[l.omnidirectional] += power;
+
+        if (qv::max(power) > brightest) {
+            brightest = qv::max(power);
+            node.light = order[i];
+        }
+
+        omnidirectional |= l.omnidirectional;
+        normal_sum += l.surfnormal;
+    }
+
+    if (!omnidirectional && !qv::emptyExact(normal_sum)) {
+        node.cone_axis = qv::normalize(normal_sum);
+        node.cone_cos = 1;
+
+        for (size_t i = first; i < last; i++) {
+            node.cone_cos = std::min(node.cone_cos, qv::dot(node.cone_axis, lights[order[i]].surfnormal));
+        }
+    }
+
+    const int32_t index = static_cast<int32_t>(tree.nodes.size());
+    tree.nodes.push_back(node);
+
+    if (last - first == 1) {
+        return index;
+    }
+
+    const size_t axis = qv::indexOfLargestMagnitudeComponent(node.pos_bounds.size());
+    std::sort(order.begin() + first, order.begin() + last, [&](int32_t a, int32_t b) {
+        if (lights[a].pos[axis] != lights[b].pos[axis]) {
+            return lights[a].pos[axis] < lights[b].pos[axis];
+        }
+        return a < b;
+    });
+
+    const size_t mid = first + (last - first) / 2;
+    const int32_t front = MakeSurfaceLightTree_r(tree, lights, order, first, mid);
+    const int32_t back = MakeSurfaceLightTree_r(tree, lights, order, mid, last);
+    tree.nodes[index].children = {front, back};
+
+    return index;
+}
+
+surfacelight_tree_t MakeSurfaceLightTree(const std::vector<surfacelight_t> &lights)
+{
+    surfacelight_tree_t tree;
+
+    if (lights.empty()) {
+        return tree;
+    }
+
+    tree.nodes.reserve(lights.size() * 2 - 1);
+
+    std::map<int32_t, std::vector<int32_t>> by_style;
+    for (size_t i = 0; i < lights.size(); i++) {
+        by_style[lights[i].style].push_back(static_cast<int32_t>(i));
+    }
+
+    for (auto &[style, order] : by_style) {
+        tree.roots.push_back(MakeSurfaceLightTree_r(tree, lights, order, 0, order.size()));
+    }
+
+    return tree;
+}
+
 // No surflight_debug (yet?), so unused...
-const std::vector<int> &SurfaceLightsForFaceNum(int facenum)
+std::span<const int> SurfaceLightsForFaceNum(int facenum)
 {
-    const auto &vec = surfacelightsByFacenum.find(facenum);
-    if (vec != surfacelightsByFacenum.end())
-        return vec->second;
+    if (facenum < 0 || facenum + 1 >= static_cast<int>(surfacelights_face_offsets.size())) {
+        return {};
+    }
 
-    static std::vector<int> empty;
-    return empty;
+    return std::span<const int>(surfacelights_by_face)
+        .subspan(surfacelights_face_offsets[facenum],
+            surfacelights_face_offsets[facenum + 1] - surfacelights_face_offsets[facenum]);
 }
 
 void // Quake 2 surface lights
@@ -225,10 +500,65 @@ MakeRadiositySurfaceLights(const settings::worldspawn_keys &cfg, const mbsp_t *b
 {
     logging::funcheader();
 
-    logging::parallel_for(
-        static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) { MakeSurfaceLightsThread(bsp, cfg, i); });
+    // map: each face finds its own emitters; they're joined in face order, so the
+    // lights (and the order LightFace_SurfaceLight sums them in) don't depend on
+    // thread scheduling
+    std::vector<std::vector<surfacelight_emitter_t>> emitters_by_face(bsp->dfaces.size());
+
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+        [&](size_t i) { MakeSurfaceLightEmittersThread(bsp, cfg, i, emitters_by_face[i]); });
+
+    std::vector<surfacelight_emitter_t> emitters;
+
+    for (auto &face_emitters : emitters_by_face) {
+        std::move(face_emitters.begin(), face_emitters.end(), std::back_inserter(emitters));
+    }
+
+    emitters_by_face.clear();
+
+    // reduce: merge neighbouring faces, then dice each group into its light
+    const auto groups = GroupSurfaceLightEmitters(emitters);
+
+    surfacelights.resize(groups.size());
+
+    logging::parallel_for(static_cast<size_t>(0), groups.size(),
+        [&](size_t i) { surfacelights[i] = MakeSurfaceLight(cfg, emitters, groups[i]); });
+
+    FindSurfaceLightLeaves(bsp, surfacelights);
+
+    // face -> light map
+    surfacelights_face_offsets.assign(bsp->dfaces.size() + 1, 0);
+
+    for (auto &group : groups) {
+        for (int32_t index : group) {
+            surfacelights_face_offsets[emitters[index].facenum + 1]++;
+        }
+    }
+
+    for (size_t i = 0; i < bsp->dfaces.size(); i++) {
+        surfacelights_face_offsets[i + 1] += surfacelights_face_offsets[i];
+    }
+
+    surfacelights_by_face.resize(surfacelights_face_offsets.back());
+
+    std::vector<int> fill(surfacelights_face_offsets.begin(), surfacelights_face_offsets.end() - 1);
+
+    for (size_t i = 0; i < groups.size(); i++) {
+        for (int32_t index : groups[i]) {
+            surfacelights_by_face[fill[emitters[index].facenum]++] = static_cast<int>(i);
+        }
+    }
+
+    total_surflight_points = 0;
+
+    for (auto &l : surfacelights) {
+        total_surflight_points += l.points.size();
+    }
+
+    surfacelighttree = MakeSurfaceLightTree(surfacelights);
 
     if (surfacelights.size()) {
-        logging::print("{} surface lights ({} light points) in use.\n", surfacelights.size(), total_surflight_points);
+        logging::print("{} surface lights ({} light points, {} faces) in use.\n", surfacelights.size(),
+            total_surflight_points, emitters.size());
     }
 }
@@ -36,7 +36,6 @@ side_t side_t::clone_non_winding_data() const
     result.onnode = this->onnode;
     result.bevel = this->bevel;
     result.source = this->source;
-    result.tested = this->tested;
     return result;
 }
 
@@ -31,9 +31,12 @@
 #include <qbsp/tree.hh>
 
 #include <list>
+#include <algorithm>
 #include <atomic>
+#include <unordered_set>
 
 #include "tbb/task_group.h"
+#include "tbb/parallel_for.h"
 
 // if a brush just barely pokes onto the other side,
 // let it slide by without chopping
@@ -46,6 +49,10 @@ constexpr int PSIDE_BOTH = (PSIDE_FRONT | PSIDE_BACK);
 // this gets OR'ed in in the return value of QuickTestBrushToPlanenum if one of the brush sides is on the input plane
 constexpr int PSIDE_FACING = 4;
 
+// SelectSplitPlane scores candidate planes in parallel once
+// (number of candidates * number of brushes) reaches this
+constexpr size_t PARALLEL_SPLIT_SELECT_THRESHOLD = 4096;
+
 struct bspstats_t : logging::stat_tracker_t
 {
     std::unique_ptr<content_stats_base_t> leafstats;
@@ -57,6 +64,8 @@ struct bspstats_t : logging::stat_tracker_t
     stat &c_qbsp3 = register_stat("expensive split nodes");
     // total number of nodes created by midsplit
     stat &c_midsplit = register_stat("mid-split nodes");
+    // total number of nodes created by the surface area heuristic
+    stat &c_sah = register_stat("surface area heuristic nodes");
     // total number of leafs
     stat &c_leafs = register_stat("leaves");
     // number of bogus brushes (beyond world extents)
@@ -67,6 +76,10 @@ struct bspstats_t : logging::stat_tracker_t
     stat &c_brushesonesided = register_stat("brushes split only on one side");
     // tiny volumes after clipping
     stat &c_tinyvolumes = register_stat("tiny volumes removed after splits");
+    // brush fragments of the splits where SplitBrush keeps both sides
+    stat &c_brushfragments = register_stat("brush fragments kept by splits");
+    // side windings of those fragments, including the midwindings
+    stat &c_sidewindings = register_stat("side windings kept by splits");
 };
 
 /*
@@ -256,75 +269,116 @@ static int QuickTestBrushToPlanenum(const bspbrush_t &brush, int planenum, int *
 ============
 TestBrushToPlanenum
 
+Returns PSIDE_BACK, PSIDE_FRONT, PSIDE_BOTH, optionally OR'ed with PSIDE_FACING.
 ============
 */
-static int TestBrushToPlanenum(
-    const bspbrush_t &brush, size_t planenum, int *numsplits, bool *hintsplit, int *epsilonbrush)
+static int TestBrushToPlanenum(const bspbrush_t &brush, size_t planenum)
 {
-    if (numsplits) {
-        *numsplits = 0;
-    }
-    if (hintsplit) {
-        *hintsplit = false;
-    }
-
     // if the brush actually uses the planenum,
     // we can tell the side for sure
     for (auto &side : brush.sides) {
-		if (side.planenum == planenum) {
-			return PSIDE_BACK | PSIDE_FACING;
+        if (side.planenum == planenum) {
+            return PSIDE_BACK | PSIDE_FACING;
         } else if (side.planenum == (planenum ^ 1)) {
-			return PSIDE_FRONT | PSIDE_FACING;
+            return PSIDE_FRONT | PSIDE_FACING;
         }
     }
 
     // box on plane side
     // int s = SphereOnPlaneSide(brush.sphere_origin, brush.sphere_radius, plane);
-    const qbsp_plane_t &plane = map.get_plane(planenum);
-    int s = BoxOnPlaneSide(brush.bounds, plane);
-    if (s != PSIDE_BOTH)
-        return s;
+    return BoxOnPlaneSide(brush.bounds, map.get_plane(planenum));
+}
 
-    if (numsplits && hintsplit && epsilonbrush) {
-        // if both sides, count the visible faces split
-        vec_t d_front = 0;
-        vec_t d_back = 0;
+/*
+ * Per-brush data that SelectSplitPlane needs for every candidate plane,
+ * gathered once per node instead of once per (candidate, brush) pair.
+ */
+struct brush_split_cache_t
+{
+    struct side_cache_t
+    {
+        const winding_t *w;
+        bool is_hint;
+        bool is_hintskip;
+    };
+
+    aabb3d bounds;
+    // planenums of all sides, for the PSIDE_FACING test
+    std::vector<size_t> planenums;
+    // only the sides that can count as a split: visible, with a winding and not on a node yet
+    std::vector<side_cache_t> split_sides;
+
+    explicit brush_split_cache_t(const bspbrush_t &brush) : bounds(brush.bounds)
+    {
+        planenums.reserve(brush.sides.size());
 
         for (const side_t &side : brush.sides) {
+            planenums.push_back(side.planenum);
+
             if (side.onnode)
                 continue; // on node, don't worry about splits
             if (!side.is_visible())
                 continue; // we don't care about non-visible
-            auto &w = side.w;
-            if (!w)
+            if (!side.w)
                 continue;
-            int front = 0;
-            int back = 0;
-            for (auto &point : w) {
-                const double d = qv::dot(point, plane.get_normal()) - plane.get_dist();
-                if (d > d_front)
-                    d_front = d;
-                if (d < d_back)
-                    d_back = d;
-
-                if (d > 0.1) // PLANESIDE_EPSILON)
-                    front = 1;
-                if (d < -0.1) // PLANESIDE_EPSILON)
-                    back = 1;
-            }
-            if (front && back) {
-                if (!(side.get_texinfo().flags.is_hintskip)) {
-                    (*numsplits)++;
-                    if (side.get_texinfo().flags.is_hint) {
-                        *hintsplit = true;
-                    }
+
+            auto &flags = side.get_texinfo().flags;
+            split_sides.push_back({&side.w, flags.is_hint, flags.is_hintskip});
+        }
+    }
+};
+
+/*
+============
+TestBrushToPlanenum
+
+Same as above, but also counts the visible faces split by the plane.
+============
+*/
+static int TestBrushToPlanenum(
+    const brush_split_cache_t &brush, size_t planenum, int &numsplits, bool &hintsplit, int &epsilonbrush)
+{
+    numsplits = 0;
+    hintsplit = false;
+
+    // if the brush actually uses the planenum,
+    // we can tell the side for sure
+    for (size_t side_planenum : brush.planenums) {
+        if (side_planenum == planenum) {
+            return PSIDE_BACK | PSIDE_FACING;
+        } else if (side_planenum == (planenum ^ 1)) {
+            return PSIDE_FRONT | PSIDE_FACING;
+        }
+    }
+
+    // box on plane side
+    const qbsp_plane_t &plane = map.get_plane(planenum);
+    int s = BoxOnPlaneSide(brush.bounds, plane);
+    if (s != PSIDE_BOTH)
+        return s;
+
+    // if both sides, count the visible faces split
+    vec_t d_front = 0;
+    vec_t d_back = 0;
+
+    for (auto &side : brush.split_sides) {
+        const point_sides_t r = side.w->classify(plane, nullptr, nullptr, 0.1); // PLANESIDE_EPSILON
+
+        d_front = std::max(d_front, r.max_front);
+        d_back = std::min(d_back, r.max_back);
+
+        if (r.counts[SIDE_FRONT] && r.counts[SIDE_BACK]) {
+            if (!side.is_hintskip) {
+                numsplits++;
+                if (side.is_hint) {
+                    hintsplit = true;
                 }
             }
         }
+    }
 
-        if ((d_front > 0.0 && d_front < 1.0) || (d_back < 0.0 && d_back > -1.0)) {
-            (*epsilonbrush)++;
-        }
+    if ((d_front > 0.0 && d_front < 1.0) || (d_back < 0.0 && d_back > -1.0)) {
+        epsilonbrush++;
     }
 
     return s;
@@ -378,15 +432,27 @@ planeside_t BrushMostlyOnSide(const bspbrush_t &brush, const qplane3d &plane)
     vec_t max = 0;
     planeside_t side = SIDE_FRONT;
     for (auto &face : brush.sides) {
-        for (size_t j = 0; j < face.w.size(); j++) {
-            vec_t d = qv::dot(face.w[j], plane.normal) - plane.dist;
-            if (d > max) {
-                max = d;
-                side = SIDE_FRONT;
-            }
-            if (-d > max) {
-                max = -d;
-                side = SIDE_BACK;
+        const point_sides_t r = face.w.classify(plane, nullptr, nullptr);
+
+        if (r.max_front > max && r.max_front > -r.max_back) {
+            max = r.max_front;
+            side = SIDE_FRONT;
+        } else if (-r.max_back > max && -r.max_back > r.max_front) {
+            max = -r.max_back;
+            side = SIDE_BACK;
+        } else if (r.max_front > max) {
+            // exact tie within the face (symmetric brushes); the first point
+            // to reach it wins, same as a point-by-point scan
+            max = r.max_front;
+            for (size_t j = 0; j < face.w.size(); j++) {
+                vec_t d = plane.distance_to(face.w[j]);
+                if (d == max) {
+                    side = SIDE_FRONT;
+                    break;
+                } else if (-d == max) {
+                    side = SIDE_BACK;
+                    break;
+                }
             }
         }
     }
@@ -471,6 +537,8 @@ static twosided<bspbrush_t::ptr> SplitBrush(bspbrush_t::ptr brush, size_t planen
 
     // split all the current windings
 
+    size_t num_windings = 0;
+
     for (const auto &face : brush->sides) {
         auto cw = face.w.clip(split, 0 /*PLANESIDE_EPSILON*/);
         for (size_t j = 0; j < 2; j++) {
@@ -481,7 +549,7 @@ static twosided<bspbrush_t::ptr> SplitBrush(bspbrush_t::ptr brush, size_t planen
             // add the clipped face to result[j]
             side_t &faceCopy = result[j]->sides.emplace_back(face.clone_non_winding_data());
             faceCopy.w = std::move(*cw[j]);
-            faceCopy.tested = false;
+            num_windings++;
             // fixme-brushbsp: configure any settings on the faceCopy?
         }
     }
@@ -535,6 +603,13 @@ static twosided<bspbrush_t::ptr> SplitBrush(bspbrush_t::ptr brush, size_t planen
         return result;
     }
 
+    if (stats) {
+        // tallied once per split, to keep the shared atomics out of the loop above;
+        // only now that both fragments survive
+        stats->get().c_brushfragments += 2;
+        stats->get().c_sidewindings += num_windings + 2;
+    }
+
     // add the midwinding to both sides
     for (int i = 0; i < 2; i++) {
         side_t &cs = result[i]->sides.emplace_back();
@@ -545,7 +620,6 @@ static twosided<bspbrush_t::ptr> SplitBrush(bspbrush_t::ptr brush, size_t planen
         // (the face that is touching the plane) should have a normal opposite the plane's normal
         cs.planenum = planenum ^ i ^ 1;
         cs.texinfo = map.skip_texinfo;
-        cs.tested = false;
         cs.onnode = true;
         Q_assert(!cs.is_visible());
 
@@ -887,6 +961,115 @@ static side_t *ChooseMidPlaneFromList(const bspbrush_t::container &brushes, cons
 }
 
 
+// number of bins per axis used by ChooseSAHPlaneFromList
+constexpr size_t SAH_BINS = 32;
+
+/*
+==================
+ChooseSAHPlaneFromList
+
+Picks the axial brush side that minimizes the surface area heuristic cost
+(area of each child's bounds times the number of brushes on that side).
+Brush counts are binned along each axis, so scoring all candidates is
+linear in the number of sides instead of sides * brushes.
+==================
+*/
+static side_t *ChooseSAHPlaneFromList(const bspbrush_t::container &brushes, const node_t *node)
+{
+    const aabb3d &bounds = node->bounds;
+    const qvec3d size = bounds.size();
+
+    // per axis, how many brushes start (mins) and end (maxs) in each bin
+    std::array<std::array<size_t, SAH_BINS>, 3> starts{}, ends{};
+
+    auto bin_for = [&](int axis, vec_t v) -> size_t {
+        if (size[axis] <= 0) {
+            return 0;
+        }
+        const vec_t f = (v - bounds.mins()[axis]) / size[axis];
+        return static_cast<size_t>(std::clamp(f * SAH_BINS, 0.0, static_cast<vec_t>(SAH_BINS - 1)));
+    };
+
+    for (auto &brush : brushes) {
+        for (int axis = 0; axis < 3; axis++) {
+            starts[axis][bin_for(axis, brush->bounds.mins()[axis])]++;
+            ends[axis][bin_for(axis, brush->bounds.maxs()[axis])]++;
+        }
+    }
+
+    // back[axis][i] = brushes that start in bins <= i,
+    // front[axis][i] = brushes that end in bins >= i
+    std::array<std::array<size_t, SAH_BINS>, 3> back{}, front{};
+
+    for (int axis = 0; axis < 3; axis++) {
+        size_t sum = 0;
+        for (size_t i = 0; i < SAH_BINS; i++) {
+            back[axis][i] = (sum += starts[axis][i]);
+        }
+        sum = 0;
+        for (size_t i = SAH_BINS; i-- > 0;) {
+            front[axis][i] = (sum += ends[axis][i]);
+        }
+    }
+
+    struct sah_candidate_t
+    {
+        vec_t cost;
+        side_t *side;
+    };
+
+    std::vector<sah_candidate_t> candidates;
+    std::unordered_set<size_t> candidate_planes;
+
+    for (auto &brush : brushes) {
+        for (auto &side : brush->sides) {
+            if (side.bevel) {
+                continue; // never use a bevel as a spliter
+            }
+            if (side.onnode) {
+                continue; // allready a node splitter
+            }
+
+            const qbsp_plane_t &plane = side.get_positive_plane();
+
+            if (plane.get_type() >= plane_type_t::PLANE_ANYX) {
+                continue; // binning only works for axial planes
+            }
+
+            const int axis = static_cast<int>(plane.get_type());
+            const vec_t dist = plane.get_dist();
+
+            if (dist <= bounds.mins()[axis] || dist >= bounds.maxs()[axis]) {
+                continue; // doesn't divide the node
+            }
+            if (!candidate_planes.insert(side.planenum & ~1).second) {
+                continue; // already scored
+            }
+
+            aabb3d front_bounds = bounds, back_bounds = bounds;
+            front_bounds[0][axis] = back_bounds[1][axis] = dist;
+
+            const size_t bin = bin_for(axis, dist);
+            const vec_t cost =
+                front_bounds.surface_area() * front[axis][bin] + back_bounds.surface_area() * back[axis][bin];
+
+            candidates.push_back({cost, &side});
+        }
+    }
+
+    // stable, so equal costs keep the brush/side order and the result is deterministic
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const sah_candidate_t &a, const sah_candidate_t &b) { return a.cost < b.cost; });
+
+    for (auto &candidate : candidates) {
+        if (CheckPlaneAgainstVolume(candidate.side->planenum & ~1, node)) {
+            return candidate.side;
+        }
+    }
+
+    return nullptr;
+}
+
 /*
 ================
 SelectSplitPlane
@@ -904,6 +1087,8 @@ static side_t *SelectSplitPlane(const bspbrush_t::container &brushes, node_t *no
 
     if (split_type != tree_split_t::PRECISE) {
         if (split_type == tree_split_t::AUTO) {
+            // the cheap method to use for large nodes
+            const tree_split_t cheap_split_type = qbsp_options.sahsplit.value() ? tree_split_t::SAH : tree_split_t::FAST;
 
             // decide if we should switch to the midsplit method
             if (qbsp_options.midsplitbrushfraction.value() != 0.0) {
@@ -911,7 +1096,7 @@ static side_t *SelectSplitPlane(const bspbrush_t::container &brushes, node_t *no
                 // how much of the map are we partitioning?
                 double fractionOfMap = brushes.size() / (double) map.total_brushes;
                 if (fractionOfMap > qbsp_options.midsplitbrushfraction.value()) {
-                    split_type = tree_split_t::FAST;
+                    split_type = cheap_split_type;
                 }
             } else {
                 // old way (ericw-tools 0.15.2+)
@@ -921,18 +1106,33 @@ static side_t *SelectSplitPlane(const bspbrush_t::container &brushes, node_t *no
                     if    ((node->bounds.maxs()[0] - node->bounds.mins()[0]) > maxnodesize
                         || (node->bounds.maxs()[1] - node->bounds.mins()[1]) > maxnodesize
                         || (node->bounds.maxs()[2] - node->bounds.mins()[2]) > maxnodesize) {
-                        split_type = tree_split_t::FAST;
+                        split_type = cheap_split_type;
                     }
                 }
             }
         }
 
+        if (split_type == tree_split_t::SAH) {
+            if (auto sah_plane = ChooseSAHPlaneFromList(brushes, node)) {
+                stats.c_sah++;
+
+                for (auto &b : brushes) {
+                    b->side = TestBrushToPlanenum(*b, sah_plane->planenum & ~1);
+                }
+
+                return sah_plane;
+            }
+
+            // no usable axial planes left; the midsplit can still pick a non-axial one
+            split_type = tree_split_t::FAST;
+        }
+
         if (split_type == tree_split_t::FAST) {
             if (auto mid_plane = ChooseMidPlaneFromList(brushes, node)) {
                 stats.c_midsplit++;
 
                 for (auto &b : brushes) {
-                    b->side = TestBrushToPlanenum(*b, mid_plane->planenum & ~1, nullptr, nullptr, nullptr);
+                    b->side = TestBrushToPlanenum(*b, mid_plane->planenum & ~1);
                 }
 
                 return mid_plane;
@@ -943,12 +1143,26 @@ static side_t *SelectSplitPlane(const bspbrush_t::container &brushes, node_t *no
     side_t *bestside = nullptr;
     int bestvalue = -99999;
 
+    std::vector<brush_split_cache_t> caches;
+    caches.reserve(brushes.size());
+    for (auto &brush : brushes) {
+        caches.emplace_back(*brush);
+    }
+
+    // positive planenums that have already been picked as candidates;
+    // each plane only needs to be evaluated once per node
+    std::unordered_set<size_t> candidate_planes;
+    std::vector<side_t *> candidates;
+    std::vector<int> values;
+
     // the search order goes: visible-structural, visible-detail,
     // nonvisible-structural, nonvisible-detail.
     // If any valid plane is available in a pass, no further
     // passes will be tried.
     constexpr int numpasses = 4;
     for (int pass = 0; pass < numpasses; pass++) {
+        candidates.clear();
+
         for (auto &brush : brushes) {
             if ((pass & 1) && !brush->contents.is_any_detail(qbsp_options.target_game))
                 continue;
@@ -961,79 +1175,90 @@ static side_t *SelectSplitPlane(const bspbrush_t::container &brushes, node_t *no
                     continue; // nothing visible, so it can't split
                 if (side.onnode)
                     continue; // allready a node splitter
-                if (side.tested)
-                    continue; // we allready have metrics for this plane
                 if (side.get_texinfo().flags.is_hintskip)
                     continue; // skip surfaces are never chosen
                 if (side.is_visible() ^ (pass < 2))
                     continue; // only check visible faces on first pass
+                if (!candidate_planes.insert(side.planenum & ~1).second)
+                    continue; // we allready have metrics for this plane
 
-                size_t positive_planenum = side.planenum & ~1;
-                const qbsp_plane_t &plane = side.get_positive_plane(); // always use positive facing plane
-
-                CheckPlaneAgainstParents(positive_planenum, node);
-
-                if (!CheckPlaneAgainstVolume(positive_planenum, node))
-                    continue; // would produce a tiny volume
-
-                int front = 0;
-                int back = 0;
-                int both = 0;
-                int facing = 0;
-                int splits = 0;
-                int epsilonbrush = 0;
-                bool hintsplit = false;
-
-                for (auto &test : brushes) {
-                    int bsplits;
-                    int s = TestBrushToPlanenum(*test, positive_planenum, &bsplits, &hintsplit, &epsilonbrush);
-
-                    splits += bsplits;
-                    if (bsplits && (s & PSIDE_FACING))
-                        Error("PSIDE_FACING with splits");
-
-                    test->testside = s;
-                    // if the brush shares this face, don't bother
-                    // testing that facenum as a splitter again
-                    if (s & PSIDE_FACING) {
-                        facing++;
-                        for (auto &testside : test->sides) {
-                            if ((testside.planenum & ~1) == (side.planenum & ~1)) {
-                                testside.tested = true;
-                            }
-                        }
-                    }
-                    if (s & PSIDE_FRONT)
-                        front++;
-                    if (s & PSIDE_BACK)
-                        back++;
-                    if (s == PSIDE_BOTH)
-                        both++;
-                }
+                candidates.push_back(&side);
+            }
+        }
 
-                // give a value estimate for using this plane
-
-                int value = 5 * facing - 5 * splits - abs(front - back);
-                //					value =  -5*splits;
-                //					value =  5*facing - 5*splits;
-                if (plane.get_type() < plane_type_t::PLANE_ANYX)
-                    value += 5; // axial is better
-                value -= epsilonbrush * 1000; // avoid!
-
-                // never split a hint side except with another hint
-                if (hintsplit && !(side.get_texinfo().flags.is_hint))
-                    value = -9999999;
-
-                // save off the side test so we don't need
-                // to recalculate it when we actually seperate
-                // the brushes
-                if (value > bestvalue) {
-                    bestvalue = value;
-                    bestside = &side;
-                    for (auto &test : brushes) {
-                        test->side = test->testside;
-                    }
-                }
+        // candidates are independent of each other, so score them in parallel;
+        // INT_MIN marks a plane that can't be used
+        values.resize(candidates.size());
+
+        auto evaluate_candidate = [&](size_t i) {
+            const side_t &side = *candidates[i];
+            size_t positive_planenum = side.planenum & ~1;
+            const qbsp_plane_t &plane = side.get_positive_plane(); // always use positive facing plane
+
+            CheckPlaneAgainstParents(positive_planenum, node);
+
+            if (!CheckPlaneAgainstVolume(positive_planenum, node)) {
+                values[i] = INT_MIN; // would produce a tiny volume
+                return;
+            }
+
+            int front = 0;
+            int back = 0;
+            int both = 0;
+            int facing = 0;
+            int splits = 0;
+            int epsilonbrush = 0;
+            bool hintsplit = false;
+
+            for (auto &test : caches) {
+                int bsplits;
+                int s = TestBrushToPlanenum(test, positive_planenum, bsplits, hintsplit, epsilonbrush);
+
+                splits += bsplits;
+                if (bsplits && (s & PSIDE_FACING))
+                    Error("PSIDE_FACING with splits");
+
+                if (s & PSIDE_FACING)
+                    facing++;
+                if (s & PSIDE_FRONT)
+                    front++;
+                if (s & PSIDE_BACK)
+                    back++;
+                if (s == PSIDE_BOTH)
+                    both++;
+            }
+
+            // give a value estimate for using this plane
+
+            int value = 5 * facing - 5 * splits - abs(front - back);
+            //					value =  -5*splits;
+            //					value =  5*facing - 5*splits;
+            if (plane.get_type() < plane_type_t::PLANE_ANYX)
+                value += 5; // axial is better
+            value -= epsilonbrush * 1000; // avoid!
+
+            // never split a hint side except with another hint
+            if (hintsplit && !(side.get_texinfo().flags.is_hint))
+                value = -9999999;
+
+            values[i] = value;
+        };
+
+        // small nodes aren't worth the task overhead
+        if (candidates.size() * brushes.size() >= PARALLEL_SPLIT_SELECT_THRESHOLD) {
+            tbb::parallel_for(static_cast<size_t>(0), candidates.size(), evaluate_candidate);
+        } else {
+            for (size_t i = 0; i < candidates.size(); i++) {
+                evaluate_candidate(i);
+            }
+        }
+
+        // the first candidate with the highest value wins, so the result
+        // is the same regardless of evaluation order
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (values[i] != INT_MIN && values[i] > bestvalue) {
+                bestvalue = values[i];
+                bestside = candidates[i];
             }
         }
 
@@ -1046,19 +1271,17 @@ static side_t *SelectSplitPlane(const bspbrush_t::container &brushes, node_t *no
         }
     }
 
-    //
-    // clear all the tested flags we set
-    //
-    for (auto &brush : brushes) {
-        for (auto &side : brush->sides) {
-            side.tested = false;
-        }
-    }
-
     if (!bestside) {
         return nullptr;
     }
 
+    // save off the side test so we don't need
+    // to recalculate it when we actually seperate
+    // the brushes
+    for (auto &b : brushes) {
+        b->side = TestBrushToPlanenum(*b, bestside->planenum & ~1);
+    }
+
     if (!bestside->is_visible()) {
         stats.c_nonvis++;
     }
@@ -30,6 +30,10 @@
 #include <qbsp/writebsp.hh>
 
 #include <list>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
 
 struct makefaces_stats_t : logging::stat_tracker_t
 {
@@ -498,9 +502,21 @@ static std::unique_ptr<face_t> FaceFromPortal(portal_t *p, bool pside)
     return f;
 }
 
+static void GatherNodes_r(node_t *node, std::vector<node_t *> &leafs, std::vector<node_t *> &nodes)
+{
+    if (node->is_leaf) {
+        leafs.push_back(node);
+        return;
+    }
+
+    nodes.push_back(node);
+    GatherNodes_r(node->children[0], leafs, nodes);
+    GatherNodes_r(node->children[1], leafs, nodes);
+}
+
 /*
 ===============
-MakeFaces_r
+MakeLeafFaces
 
 If a portal will make a visible face,
 mark the side that originally created it
@@ -509,27 +525,18 @@ mark the side that originally created it
   solid / water : solid
   water / empty : water
   water / water : none
+
+The faces are returned rather than added to the portal's node, since
+other leafs may be adding to the same node in parallel.
 ===============
 */
-static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
+static std::vector<std::unique_ptr<face_t>> MakeLeafFaces(node_t *node)
 {
-    // recurse down to leafs
-    if (!node->is_leaf) {
-        MakeFaces_r(node->children[0], stats);
-        MakeFaces_r(node->children[1], stats);
-
-        // merge together all visible faces on the node
-        if (!qbsp_options.nomerge.value())
-            MergeNodeFaces(node, stats);
-        if (qbsp_options.subdivide.boolValue())
-            SubdivideNodeFaces(node, stats);
-
-        return;
-    }
+    std::vector<std::unique_ptr<face_t>> faces;
 
     // solid leafs never have visible faces
     if (node->contents.is_any_solid(qbsp_options.target_game))
-        return;
+        return faces;
 
     // see which portals are valid
 
@@ -543,15 +550,25 @@ static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
         std::unique_ptr<face_t> f = FaceFromPortal(p, is_on_back);
 
         if (f) {
-            stats.c_nodefaces++;
-            p->onnode->facelist.push_back(std::move(f));
+            faces.push_back(std::move(f));
         }
     }
+
+    return faces;
 }
 
 /*
 ============
 MakeFaces
+
+Every face made from a leaf's portals ends up on a node above the leaf, and
+each node's faces are merged and subdivided independently, so this runs in
+three steps:
+
+1. make the faces for each leaf, in parallel
+2. hand them to their nodes, in tree order (so the facelists, and therefore
+   the merge results, are the same as a serial depth-first walk)
+3. merge and subdivide each node's faces, in parallel
 ============
 */
 void MakeFaces(node_t *node)
@@ -560,5 +577,30 @@ void MakeFaces(node_t *node)
 
     makefaces_stats_t stats{};
 
-    MakeFaces_r(node, stats);
+    std::vector<node_t *> leafs, nodes;
+    GatherNodes_r(node, leafs, nodes);
+
+    std::vector<std::vector<std::unique_ptr<face_t>>> leaf_faces(leafs.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), leafs.size(), [&](size_t i) { leaf_faces[i] = MakeLeafFaces(leafs[i]); });
+
+    size_t num_faces = 0;
+
+    for (auto &faces : leaf_faces) {
+        for (auto &f : faces) {
+            f->portal->onnode->facelist.push_back(std::move(f));
+            num_faces++;
+        }
+    }
+
+    stats.c_nodefaces += num_faces;
+    leaf_faces.clear();
+
+    tbb::parallel_for_each(nodes, [&](node_t *n) {
+        // merge together all visible faces on the node
+        if (!qbsp_options.nomerge.value())
+            MergeNodeFaces(n, stats);
+        if (qbsp_options.subdivide.boolValue())
+            SubdivideNodeFaces(n, stats);
+    });
 }
@@ -44,6 +44,8 @@
 
 #include <pareto/spatial_map.h>
 
+#include <tbb/parallel_for.h>
+
 mapdata_t map;
 
 mapplane_t::mapplane_t(const qbsp_plane_t &copy) : qbsp_plane_t(copy) { }
@@ -754,13 +756,13 @@ static quark_tx_info_t ParseExtendedTX(parser_t &parser)
     } else {
         // Parse extra Quake 2 surface info
         if (parser.parse_token(PARSE_OPTIONAL)) {
-            result.info = extended_texinfo_t{{std::stoi(parser.token)}};
+            result.info = extended_texinfo_t{{parse_int(parser.token)}};
 
             if (parser.parse_token(PARSE_OPTIONAL)) {
-                result.info->flags.native = std::stoi(parser.token);
+                result.info->flags.native = parse_int(parser.token);
             }
             if (parser.parse_token(PARSE_OPTIONAL)) {
-                result.info->value = std::stoi(parser.token);
+                result.info->value = parse_int(parser.token);
             }
         }
     }
@@ -1284,7 +1286,7 @@ static void SetTexinfo_QuakeEd(const qbsp_plane_t &plane, const std::array<qvec3
 }
 
 static void SetTexinfo_QuArK(
-    parser_t &parser, const std::array<qvec3d, 3> &planepts, texcoord_style_t style, maptexinfo_t *out)
+    const parser_source_location &location, const std::array<qvec3d, 3> &planepts, texcoord_style_t style, maptexinfo_t *out)
 {
     int i;
     qvec3d vecs[2];
@@ -1305,7 +1307,7 @@ static void SetTexinfo_QuArK(
             vecs[0] = planepts[1] - planepts[0];
             vecs[1] = planepts[2] - planepts[0];
             break;
-        default: FError("{}: bad texture coordinate style", parser.location);
+        default: FError("{}: bad texture coordinate style", location);
     }
 
     vecs[0] *= 1.0 / 128.0;
@@ -1327,7 +1329,7 @@ static void SetTexinfo_QuArK(
      */
     determinant = a * d - b * c;
     if (fabs(determinant) < ZERO_EPSILON) {
-        logging::print("WARNING: {}: Face with degenerate QuArK-style texture axes\n", parser.location);
+        logging::print("WARNING: {}: Face with degenerate QuArK-style texture axes\n", location);
         for (i = 0; i < 3; i++)
             out->vecs.at(0, i) = out->vecs.at(1, i) = 0;
     } else {
@@ -1464,6 +1466,27 @@ static texdef_brush_primitives_t TexDef_BSPToBrushPrimitives(
     return res;
 }
 
+// a brush face as written in the .map, before its plane and texinfo
+// have been looked up; these can be parsed on any thread
+struct mapface_def_t
+{
+    parser_source_location line;
+    std::array<qvec3d, 3> planepts{};
+    std::string texname;
+    texcoord_style_t tx_type = TX_QUAKED;
+    qmat<vec_t, 2, 3> texMat{}, axis{};
+    qvec2d shift{}, scale{};
+    vec_t rotate = 0;
+    quark_tx_info_t extinfo;
+};
+
+struct mapbrush_def_t
+{
+    brushformat_t format = brushformat_t::NORMAL;
+    parser_source_location line;
+    std::vector<mapface_def_t> faces;
+};
+
 static void ParsePlaneDef(parser_t &parser, std::array<qvec3d, 3> &planepts)
 {
     int i, j;
@@ -1476,7 +1499,7 @@ static void ParsePlaneDef(parser_t &parser, std::array<qvec3d, 3> &planepts)
 
         for (j = 0; j < 3; j++) {
             parser.parse_token(PARSE_SAMELINE);
-            planepts[i][j] = std::stod(parser.token);
+            planepts[i][j] = parse_double(parser.token);
         }
 
         parser.parse_token(PARSE_SAMELINE);
@@ -1499,20 +1522,20 @@ static void ParseValve220TX(parser_t &parser, qmat<vec_t, 2, 3> &axis, qvec2d &s
             goto parse_error;
         for (j = 0; j < 3; j++) {
             parser.parse_token(PARSE_SAMELINE);
-            axis.at(i, j) = std::stod(parser.token);
+            axis.at(i, j) = parse_double(parser.token);
         }
         parser.parse_token(PARSE_SAMELINE);
-        shift[i] = std::stod(parser.token);
+        shift[i] = parse_double(parser.token);
         parser.parse_token(PARSE_SAMELINE);
         if (parser.token != "]")
             goto parse_error;
     }
     parser.parse_token(PARSE_SAMELINE);
-    rotate = std::stod(parser.token);
+    rotate = parse_double(parser.token);
     parser.parse_token(PARSE_SAMELINE);
-    scale[0] = std::stod(parser.token);
+    scale[0] = parse_double(parser.token);
     parser.parse_token(PARSE_SAMELINE);
-    scale[1] = std::stod(parser.token);
+    scale[1] = parse_double(parser.token);
     return;
 
 parse_error:
@@ -1532,7 +1555,7 @@ static void ParseBrushPrimTX(parser_t &parser, qmat<vec_t, 2, 3> &texMat)
 
         for (int j = 0; j < 3; j++) {
             parser.parse_token(PARSE_SAMELINE);
-            texMat.at(i, j) = std::stod(parser.token);
+            texMat.at(i, j) = parse_double(parser.token);
         }
 
         parser.parse_token(PARSE_SAMELINE);
@@ -1550,65 +1573,78 @@ parse_error:
     FError("{}: couldn't parse Brush Primitives texture info", parser.location);
 }
 
-static void ParseTextureDef(parser_t &parser, mapface_t &mapface, const mapbrush_t &brush, maptexinfo_t *tx,
-    std::array<qvec3d, 3> &planepts, const qplane3d &plane, texture_def_issues_t &issue_stats)
-{
-    vec_t rotate;
-    qmat<vec_t, 2, 3> texMat, axis;
-    qvec2d shift, scale;
-    texcoord_style_t tx_type;
-
-    quark_tx_info_t extinfo;
+/*
+=================
+ParseTextureDef
 
-    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
-        ParseBrushPrimTX(parser, texMat);
-        tx_type = TX_BRUSHPRIM;
+Reads the texture half of a brush face; nothing is looked up here
+=================
+*/
+static void ParseTextureDef(parser_t &parser, brushformat_t format, mapface_def_t &def)
+{
+    if (format == brushformat_t::BRUSH_PRIMITIVES) {
+        ParseBrushPrimTX(parser, def.texMat);
+        def.tx_type = TX_BRUSHPRIM;
 
         parser.parse_token(PARSE_SAMELINE);
-        mapface.texname = parser.token;
+        def.texname = parser.token;
 
         // Read extra Q2 params
-        extinfo = ParseExtendedTX(parser);
-
-        mapface.raw_info = extinfo.info;
-    } else if (brush.format == brushformat_t::NORMAL) {
+        def.extinfo = ParseExtendedTX(parser);
+    } else if (format == brushformat_t::NORMAL) {
         parser.parse_token(PARSE_SAMELINE);
-        mapface.texname = parser.token;
+        def.texname = parser.token;
 
         parser.parse_token(PARSE_SAMELINE | PARSE_PEEK);
         if (parser.token == "[") {
-            ParseValve220TX(parser, axis, shift, rotate, scale);
-            tx_type = TX_VALVE_220;
+            ParseValve220TX(parser, def.axis, def.shift, def.rotate, def.scale);
+            def.tx_type = TX_VALVE_220;
 
             // Read extra Q2 params
-            extinfo = ParseExtendedTX(parser);
+            def.extinfo = ParseExtendedTX(parser);
         } else {
             parser.parse_token(PARSE_SAMELINE);
-            shift[0] = std::stod(parser.token);
+            def.shift[0] = parse_double(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            shift[1] = std::stod(parser.token);
+            def.shift[1] = parse_double(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            rotate = std::stod(parser.token);
+            def.rotate = parse_double(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            scale[0] = std::stod(parser.token);
+            def.scale[0] = parse_double(parser.token);
             parser.parse_token(PARSE_SAMELINE);
-            scale[1] = std::stod(parser.token);
+            def.scale[1] = parse_double(parser.token);
 
             // Read extra Q2 params and/or QuArK subtype
-            extinfo = ParseExtendedTX(parser);
-            if (extinfo.quark_tx1) {
-                tx_type = TX_QUARK_TYPE1;
-            } else if (extinfo.quark_tx2) {
-                tx_type = TX_QUARK_TYPE2;
+            def.extinfo = ParseExtendedTX(parser);
+            if (def.extinfo.quark_tx1) {
+                def.tx_type = TX_QUARK_TYPE1;
+            } else if (def.extinfo.quark_tx2) {
+                def.tx_type = TX_QUARK_TYPE2;
             } else {
-                tx_type = TX_QUAKED;
+                def.tx_type = TX_QUAKED;
             }
         }
-
-        mapface.raw_info = extinfo.info;
     } else {
         FError("{}: Bad brush format", parser.location);
     }
+}
+
+/*
+=================
+SetTexinfoFromDef
+
+Turns a parsed texture def into the face's texture and texinfo, loading
+the texture if needed
+=================
+*/
+static void SetTexinfoFromDef(const mapface_def_t &def, mapface_t &mapface, maptexinfo_t *tx,
+    const qplane3d &plane, texture_def_issues_t &issue_stats)
+{
+    quark_tx_info_t extinfo = def.extinfo;
+    const texcoord_style_t tx_type = def.tx_type;
+
+    mapface.texname = def.texname;
+    mapface.raw_info = extinfo.info;
 
     // if we have texture defs, see if we should remap this one
     if (auto it = qbsp_options.loaded_texture_defs.find(mapface.texname);
@@ -1690,18 +1726,22 @@ static void ParseTextureDef(parser_t &parser, mapface_t &mapface, const mapbrush
 
     switch (tx_type) {
         case TX_QUARK_TYPE1:
-        case TX_QUARK_TYPE2: SetTexinfo_QuArK(parser, planepts, tx_type, tx); break;
-        case TX_VALVE_220: SetTexinfo_Valve220(axis, shift, scale, tx); break;
+        case TX_QUARK_TYPE2: SetTexinfo_QuArK(def.line, mapface.planepts, tx_type, tx); break;
+        case TX_VALVE_220: {
+            qmat<vec_t, 2, 3> axis = def.axis;
+            SetTexinfo_Valve220(axis, def.shift, def.scale, tx);
+            break;
+        }
         case TX_BRUSHPRIM: {
             const auto &texture = map.load_image_meta(mapface.texname.c_str());
             const int32_t width = texture ? texture->width : 64;
             const int32_t height = texture ? texture->height : 64;
 
-            SetTexinfo_BrushPrimitives(texMat, plane.normal, width, height, tx->vecs);
+            SetTexinfo_BrushPrimitives(def.texMat, plane.normal, width, height, tx->vecs);
             break;
         }
         case TX_QUAKED:
-        default: SetTexinfo_QuakeEd(plane, planepts, shift, rotate, scale, tx); break;
+        default: SetTexinfo_QuakeEd(plane, mapface.planepts, def.shift, def.rotate, def.scale, tx); break;
     }
 }
 
@@ -1792,24 +1832,41 @@ static void ValidateTextureProjection(mapface_t &mapface, maptexinfo_t *tx)
     }
 }
 
-static std::optional<mapface_t> ParseBrushFace(parser_t &parser, const mapbrush_t &brush, const mapentity_t &entity, texture_def_issues_t &issue_stats)
+static mapface_def_t ParseBrushFace(parser_t &parser, brushformat_t format)
+{
+    mapface_def_t def;
+
+    def.line = parser.location;
+
+    ParsePlaneDef(parser, def.planepts);
+    ParseTextureDef(parser, format, def);
+
+    return def;
+}
+
+/*
+=================
+LoadBrushFace
+
+Finds the plane and texinfo of a parsed face. This adds to the map's planes
+and texinfos, so it has to be called in map order.
+=================
+*/
+static std::optional<mapface_t> LoadBrushFace(const mapface_def_t &def, const mapentity_t &entity, texture_def_issues_t &issue_stats)
 {
-    std::array<qvec3d, 3> planepts;
     bool normal_ok;
     maptexinfo_t tx;
     int i, j;
     mapface_t face;
 
-    face.line = parser.location;
-
-    ParsePlaneDef(parser, planepts);
+    face.line = def.line;
 
-    normal_ok = face.set_planepts(planepts);
+    normal_ok = face.set_planepts(def.planepts);
 
-    ParseTextureDef(parser, face, brush, &tx, face.planepts, face.get_plane(), issue_stats);
+    SetTexinfoFromDef(def, face, &tx, face.get_plane(), issue_stats);
 
     if (!normal_ok) {
-        logging::print("WARNING: {}: Brush plane with no normal\n", parser.location);
+        logging::print("WARNING: {}: Brush plane with no normal\n", def.line);
         return std::nullopt;
     }
 
@@ -2302,9 +2359,9 @@ static contentflags_t Brush_GetContents(const mapentity_t &entity, const mapbrus
     return base_contents;
 }
 
-static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats)
+static mapbrush_def_t ParseBrush(parser_t &parser)
 {
-    mapbrush_t brush;
+    mapbrush_def_t brush;
 
     // ericw -- brush primitives
     if (!parser.parse_token(PARSE_PEEK))
@@ -2338,7 +2395,30 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
         if (parser.token == "}")
             break;
 
-        std::optional<mapface_t> face = ParseBrushFace(parser, brush, entity, issue_stats);
+        brush.faces.emplace_back(ParseBrushFace(parser, brush.format));
+    }
+
+    // ericw -- brush primitives - there should be another closing }
+    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
+        if (!parser.parse_token())
+            FError("Brush primitives: unexpected EOF (no closing brace)");
+        if (parser.token != "}")
+            FError("Brush primitives: Expected }, got: {}", parser.token);
+    }
+    // ericw -- end brush primitives
+
+    return brush;
+}
+
+static mapbrush_t LoadMapBrush(const mapbrush_def_t &def, mapentity_t &entity, texture_def_issues_t &issue_stats)
+{
+    mapbrush_t brush;
+
+    brush.format = def.format;
+    brush.line = def.line;
+
+    for (auto &face_def : def.faces) {
+        std::optional<mapface_t> face = LoadBrushFace(face_def, entity, issue_stats);
 
         if (!face) {
             continue;
@@ -2348,13 +2428,13 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
         bool discardFace = false;
         for (auto &check : brush.faces) {
             if (qv::epsilonEqual(check.get_plane(), face->get_plane())) {
-                logging::print("{}: Brush with duplicate plane\n", parser.location);
+                logging::print("{}: Brush with duplicate plane\n", face->line);
                 discardFace = true;
                 continue;
             }
             if (qv::epsilonEqual(-check.get_plane(), face->get_plane())) {
                 /* FIXME - this is actually an invalid brush */
-                logging::print("{}: Brush with duplicate plane\n", parser.location);
+                logging::print("{}: Brush with duplicate plane\n", face->line);
                 continue;
             }
         }
@@ -2367,20 +2447,21 @@ static mapbrush_t ParseBrush(parser_t &parser, mapentity_t &entity, texture_def_
         brush.faces.emplace_back(std::move(face.value()));
     }
 
-    // ericw -- brush primitives - there should be another closing }
-    if (brush.format == brushformat_t::BRUSH_PRIMITIVES) {
-        if (!parser.parse_token())
-            FError("Brush primitives: unexpected EOF (no closing brace)");
-        if (parser.token != "}")
-            FError("Brush primitives: Expected }, got: {}", parser.token);
-    }
-    // ericw -- end brush primitives
-
     brush.contents = Brush_GetContents(entity, brush);
 
     return brush;
 }
 
+/*
+=================
+ParseEntity
+
+Brushes are only skipped over while reading the entity; the skipped text
+is then parsed on all threads, and the planes and texinfos are looked up
+afterwards, in file order, so the plane and texinfo numbering doesn't
+depend on thread scheduling.
+=================
+*/
 bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &issue_stats)
 {
     entity.location = parser.location;
@@ -2401,6 +2482,14 @@ bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &is
 
     bool first_brush = false;
 
+    struct brush_block_t
+    {
+        const char *start, *end;
+        size_t line;
+    };
+
+    std::vector<brush_block_t> brush_blocks;
+
     do {
         if (!parser.parse_token())
             FError("Unexpected EOF (no closing brace)");
@@ -2423,13 +2512,36 @@ bool ParseEntity(parser_t &parser, mapentity_t &entity, texture_def_issues_t &is
                     }
                 } while (parser.token != "}");
             } else {
-                entity.mapbrushes.emplace_back(ParseBrush(parser, entity, issue_stats));
+                brush_block_t &block = brush_blocks.emplace_back();
+                block.start = parser.pos;
+                block.line = parser.location.line_number.value();
+
+                if (!parser.skip_block()) {
+                    FError("Unexpected EOF (no closing brace)");
+                }
+
+                block.end = parser.pos;
             }
         } else {
             ParseEpair(parser, entity);
         }
     } while (1);
 
+    std::vector<mapbrush_def_t> brush_defs(brush_blocks.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), brush_blocks.size(), [&](size_t i) {
+        const brush_block_t &block = brush_blocks[i];
+        parser_t brush_parser(block.start, block.end - block.start, parser.location);
+        brush_parser.location.line_number = block.line;
+        brush_defs[i] = ParseBrush(brush_parser);
+    });
+
+    entity.mapbrushes.reserve(brush_defs.size());
+
+    for (auto &brush_def : brush_defs) {
+        entity.mapbrushes.emplace_back(LoadMapBrush(brush_def, entity, issue_stats));
+    }
+
     // replace aliases
     auto alias_it = qbsp_options.loaded_entity_defs.find(entity.epairs.get("classname"));
 
@@ -28,6 +28,12 @@
 #include <qbsp/map.hh>
 #include <qbsp/faces.hh>
 
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <tuple>
+#include <vector>
+
 #ifdef PARANOID
 static void CheckColinear(face_t *f)
 {
@@ -177,17 +183,81 @@ void MergeFaceToList(std::unique_ptr<face_t> face, std::list<std::unique_ptr<fac
     list.emplace_back(std::move(face));
 }
 
+// a face tagged with the position in the input list of the face
+// that started its merge chain
+using tagged_face_t = std::pair<size_t, std::unique_ptr<face_t>>;
+
+/*
+===============
+MergeFaceToBucket
+
+Same as MergeFaceToList, but keeps the tag of `face` with the result.
+===============
+*/
+static void MergeFaceToBucket(tagged_face_t face, std::list<tagged_face_t> &list, size_t &num_merged)
+{
+    for (auto it = list.begin(); it != list.end();) {
+        std::unique_ptr<face_t> newf = TryMerge(face.second.get(), it->second.get());
+
+        if (newf) {
+            list.erase(it);
+            // restart, now trying to merge `newf` into the list
+            face.second = std::move(newf);
+            it = list.begin();
+            num_merged++;
+        } else {
+            it++;
+        }
+    }
+
+    list.emplace_back(std::move(face));
+}
+
 /*
 ===============
 MergeFaceList
+
+TryMerge only ever merges faces with the same plane, texinfo and lmshift,
+so the input is split into buckets by those and each bucket is merged on
+its own, rather than testing every face against every other face.
+
+Each face in the result is emitted where merging the whole list in one go
+would have appended it, so the output is identical to the unbucketed merge.
 ===============
 */
 std::list<std::unique_ptr<face_t>> MergeFaceList(std::list<std::unique_ptr<face_t>> input, logging::stat_tracker_t::stat &num_merged)
 {
-    std::list<std::unique_ptr<face_t>> result;
+    using bucket_key_t = std::tuple<size_t, int, int>;
+    std::map<bucket_key_t, std::list<tagged_face_t>> buckets;
+    std::list<tagged_face_t> unmergeable;
+    size_t merged = 0;
 
+    size_t index = 0;
     for (auto &face : input) {
-        MergeFaceToList(std::move(face), result, num_merged);
+        if (!face->w.size()) {
+            // TryMerge never merges empty windings
+            unmergeable.emplace_back(index++, std::move(face));
+            continue;
+        }
+
+        auto &bucket = buckets[{face->planenum, face->texinfo, face->original_side->lmshift}];
+        MergeFaceToBucket({index++, std::move(face)}, bucket, merged);
+    }
+
+    num_merged += merged;
+
+    std::vector<tagged_face_t> tagged;
+    tagged.reserve(index);
+    for (auto &[key, bucket] : buckets) {
+        std::move(bucket.begin(), bucket.end(), std::back_inserter(tagged));
+    }
+    std::move(unmergeable.begin(), unmergeable.end(), std::back_inserter(tagged));
+
+    std::sort(tagged.begin(), tagged.end(), [](const tagged_face_t &a, const tagged_face_t &b) { return a.first < b.first; });
+
+    std::list<std::unique_ptr<face_t>> result;
+    for (auto &[i, face] : tagged) {
+        result.push_back(std::move(face));
     }
 
     return result;
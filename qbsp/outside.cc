@@ -28,15 +28,22 @@
 #include <qbsp/tree.hh>
 
 #include <common/log.hh>
+#include <common/parallel.hh>
+#include <algorithm>
+#include <atomic>
 #include <climits>
+#include <optional>
 #include <vector>
 #include <set>
 #include <list>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <fstream>
 #include <fmt/ostream.h>
 
+#include <tbb/enumerable_thread_specific.h>
+
 static bool LeafSealsMap(const node_t *node)
 {
     Q_assert(node->is_leaf);
@@ -107,131 +114,175 @@ static bool OutsideFill_Passable(const portal_t *p)
 }
 
 /*
-==================
-MarkClusterOutsideDistance_R
+ * Flat (CSR) copy of the leaf adjacency through passable portals.
+ *
+ * Built once per FillOutside, so the flood fills and leak line searches
+ * index contiguous arrays instead of chasing node->portals / portal->next.
+ * Edges are stored in portal list order, so walks that pick the first
+ * best neighbour give the same result as walking the portal lists.
+ */
+struct leaf_graph_t
+{
+    std::vector<node_t *> leafs;
+    std::unordered_map<const node_t *, size_t> leaf_index;
+    // the edges of leafs[i] are [offsets[i], offsets[i + 1])
+    std::vector<size_t> offsets;
+    std::vector<size_t> neighbours;
+    std::vector<portal_t *> portals;
+
+    size_t index_of(const node_t *leaf) const
+    {
+        auto it = leaf_index.find(leaf);
+        Q_assert(it != leaf_index.end());
+        return it->second;
+    }
+};
 
-Given that the cluster is reachable from the void, sets outside_distance
-to the given value on this cluster and all desdcent leafs (if it's a detail cluster).
-==================
-*/
-static void MarkClusterOutsideDistance_R(node_t *node, int outside_distance)
+static void GatherLeafs_r(node_t *node, leaf_graph_t &graph)
 {
-    node->outside_distance = outside_distance;
+    if (node->is_leaf) {
+        graph.leaf_index.emplace(node, graph.leafs.size());
+        graph.leafs.push_back(node);
+        return;
+    }
 
-    if (!node->is_leaf) {
-        MarkClusterOutsideDistance_R(node->children[0], outside_distance);
-        MarkClusterOutsideDistance_R(node->children[1], outside_distance);
+    GatherLeafs_r(node->children[0], graph);
+    GatherLeafs_r(node->children[1], graph);
+}
+
+static leaf_graph_t MakeLeafGraph(node_t *headnode)
+{
+    leaf_graph_t graph;
+    GatherLeafs_r(headnode, graph);
+
+    graph.offsets.reserve(graph.leafs.size() + 1);
+
+    for (node_t *node : graph.leafs) {
+        graph.offsets.push_back(graph.neighbours.size());
+
+        int side;
+        for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
+            side = (portal->nodes[0] == node);
+
+            if (!OutsideFill_Passable(portal))
+                continue;
+
+            graph.neighbours.push_back(graph.index_of(portal->nodes[side]));
+            graph.portals.push_back(portal);
+        }
     }
+
+    graph.offsets.push_back(graph.neighbours.size());
+
+    return graph;
 }
 
+// frontiers smaller than this are expanded serially
+constexpr size_t PARALLEL_FLOOD_FRONTIER = 1024;
+
 /*
 ==================
-FloodFillFromOutsideNode
+FloodFillLeafGraph
 
-Sets outside_distance on clusters reachable from the void
-
-preconditions:
-- all leafs have outside_distance set to -1
+Level-synchronous breadth-first search from `sources`, which are given
+distance `first_distance`. Returns the distance of each leaf, or -1 if
+it can't be reached. Large frontiers are expanded in parallel; the
+distances don't depend on the order leafs are visited in.
 ==================
 */
-static void FloodFillClustersFromVoid(tree_t &tree)
+static std::vector<int> FloodFillLeafGraph(
+    const leaf_graph_t &graph, const std::vector<size_t> &sources, int first_distance)
 {
-    // breadth-first search
-    std::list<std::pair<node_t *, int>> queue;
-    std::unordered_set<node_t *> visited_nodes;
-
-    // push a node onto the queue which is in the void, but has a portal to outside_node
-    // NOTE: remember, the headnode has no relationship to the outside of the map.
-    {
-        const int side = (tree.outside_node.portals->nodes[0] == &tree.outside_node);
-        node_t *fillnode = tree.outside_node.portals->nodes[side];
-
-        Q_assert(fillnode != &tree.outside_node);
-
-        // this must be true because the map is made from closed brushes, beyond which is void
-        Q_assert(!LeafSealsMap(fillnode));
-        queue.emplace_back(fillnode, 0);
+    std::vector<std::atomic<int>> distances(graph.leafs.size());
+    for (auto &d : distances) {
+        d.store(-1, std::memory_order_relaxed);
     }
 
-    while (!queue.empty()) {
-        const auto front = queue.front();
-        queue.pop_front();
+    std::vector<size_t> frontier;
+    for (size_t source : sources) {
+        int expected = -1;
+        if (distances[source].compare_exchange_strong(expected, first_distance)) {
+            frontier.push_back(source);
+        }
+    }
 
-        auto [node, outside_distance] = front;
+    std::vector<size_t> next_frontier;
 
-        if (visited_nodes.find(node) != visited_nodes.end()) {
-            // have already visited this node
-            continue;
-        }
+    for (int distance = first_distance + 1; !frontier.empty(); distance++) {
+        next_frontier.clear();
 
-        // visit node
-        visited_nodes.insert(node);
-        MarkClusterOutsideDistance_R(node, outside_distance);
+        auto visit = [&](size_t leaf, std::vector<size_t> &out) {
+            for (size_t e = graph.offsets[leaf]; e < graph.offsets[leaf + 1]; e++) {
+                const size_t neighbour = graph.neighbours[e];
+                int expected = -1;
+                if (distances[neighbour].compare_exchange_strong(expected, distance)) {
+                    out.push_back(neighbour);
+                }
+            }
+        };
 
-        // push neighbouring nodes onto the back of the queue
-        int side;
-        for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
-            side = (portal->nodes[0] == node);
+        if (frontier.size() < PARALLEL_FLOOD_FRONTIER) {
+            for (size_t leaf : frontier) {
+                visit(leaf, next_frontier);
+            }
+        } else {
+            tbb::enumerable_thread_specific<std::vector<size_t>> local_frontiers;
 
-            if (!OutsideFill_Passable(portal))
-                continue;
+            tbb::parallel_for(static_cast<size_t>(0), frontier.size(),
+                [&](size_t i) { visit(frontier[i], local_frontiers.local()); });
 
-            node_t *neighbour = portal->nodes[side];
-            queue.emplace_back(neighbour, outside_distance + 1);
+            for (auto &local : local_frontiers) {
+                next_frontier.insert(next_frontier.end(), local.begin(), local.end());
+            }
         }
+
+        std::swap(frontier, next_frontier);
+    }
+
+    std::vector<int> result(distances.size());
+    for (size_t i = 0; i < distances.size(); i++) {
+        result[i] = distances[i].load(std::memory_order_relaxed);
     }
+    return result;
 }
 
 /*
 =============
-FindPortalsToVoid
+WalkToNearestSource
 
-Given an occupied leaf, returns a list of porals leading to the void
+Given leaf distances from a flood fill, follows the shortest path
+from `leaf` back to a leaf of `target_distance`, returning the
+portals crossed. `leaf` is updated to the leaf that was reached.
 =============
 */
-static std::vector<portal_t *> FindPortalsToVoid(node_t *occupied_leaf)
+static std::vector<portal_t *> WalkToNearestSource(
+    const leaf_graph_t &graph, const std::vector<int> &distances, size_t &leaf, int target_distance)
 {
-    Q_assert(occupied_leaf->occupant != nullptr);
-    Q_assert(occupied_leaf->outside_distance >= 0);
+    Q_assert(distances[leaf] >= target_distance);
 
     std::vector<portal_t *> result;
 
-    node_t *node = occupied_leaf;
-    while (1) {
-        // exit?
-        if (node->outside_distance == 0)
-            break; // this is the void leaf where we started the flood fill in FloodFillFromVoid()
-
+    while (distances[leaf] != target_distance) {
         // find the next node...
+        std::optional<size_t> bestedge;
+        int bestdist = distances[leaf];
 
-        node_t *bestneighbour = nullptr;
-        portal_t *bestportal = nullptr;
-        int bestdist = node->outside_distance;
-
-        int side;
-        for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
-            side = (portal->nodes[0] == node);
-
-            if (!OutsideFill_Passable(portal))
-                continue;
-
-            node_t *neighbour = portal->nodes[side];
-            Q_assert(neighbour != node);
-            Q_assert(neighbour->outside_distance >= 0);
+        for (size_t e = graph.offsets[leaf]; e < graph.offsets[leaf + 1]; e++) {
+            const size_t neighbour = graph.neighbours[e];
+            Q_assert(neighbour != leaf);
+            Q_assert(distances[neighbour] >= target_distance);
 
-            if (neighbour->outside_distance < bestdist) {
-                bestneighbour = neighbour;
-                bestportal = portal;
-                bestdist = neighbour->outside_distance;
+            if (distances[neighbour] < bestdist) {
+                bestedge = e;
+                bestdist = distances[neighbour];
             }
         }
 
-        Q_assert(bestneighbour != nullptr);
-        Q_assert(bestdist < node->outside_distance);
+        Q_assert(bestedge.has_value());
 
-        // go through bestportal
-        result.push_back(bestportal);
-        node = bestneighbour;
+        // go through the best portal
+        result.push_back(graph.portals[*bestedge]);
+        leaf = graph.neighbours[*bestedge];
     }
 
     return result;
@@ -488,96 +539,6 @@ static void SetOccupied_R(node_t *node, int dist)
 }
 #endif
 
-/*
-==================
-precondition: all leafs have occupied set to 0
-==================
-*/
-static void BFSFloodFillFromOccupiedLeafs(const std::vector<node_t *> &occupied_leafs)
-{
-    std::list<std::pair<node_t *, int>> queue;
-    for (node_t *leaf : occupied_leafs) {
-        queue.push_back(std::make_pair(leaf, 1));
-    }
-
-    while (!queue.empty()) {
-        auto pair = queue.front();
-        queue.pop_front();
-
-        node_t *node = pair.first;
-        const int dist = pair.second;
-
-        if (node->occupied == 0) {
-            // we haven't visited this node yet
-            Q_assert(!node->detail_separator);
-            node->occupied = dist;
-
-            // push neighbouring nodes onto the back of the queue
-            int side;
-            for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
-                side = (portal->nodes[0] == node);
-
-                if (!OutsideFill_Passable(portal))
-                    continue;
-
-                node_t *neighbour = portal->nodes[side];
-                queue.push_back(std::make_pair(neighbour, dist + 1));
-            }
-        }
-    }
-}
-
-static std::vector<portal_t *> MakeLeakLine(node_t *outleaf, mapentity_t *&leakentity)
-{
-    std::vector<portal_t *> result;
-
-    Q_assert(outleaf->occupied > 0);
-
-    node_t *node = outleaf;
-    while (1) {
-        // exit?
-        if (node->occupied == 1)
-            break; // this node contains an entity
-
-        // find the next node...
-
-        node_t *bestneighbour = nullptr;
-        portal_t *bestportal = nullptr;
-        int bestoccupied = node->occupied;
-
-        int side;
-        for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
-            side = (portal->nodes[0] == node);
-
-            if (!OutsideFill_Passable(portal))
-                continue;
-
-            node_t *neighbour = portal->nodes[side];
-            Q_assert(neighbour != node);
-            Q_assert(neighbour->occupied > 0);
-
-            if (neighbour->occupied < bestoccupied) {
-                bestneighbour = neighbour;
-                bestportal = portal;
-                bestoccupied = neighbour->occupied;
-            }
-        }
-
-        Q_assert(bestneighbour != nullptr);
-        Q_assert(bestoccupied < node->occupied);
-
-        // go through bestportal
-        result.push_back(bestportal);
-        node = bestneighbour;
-    }
-
-    Q_assert(node->occupant != nullptr);
-    Q_assert(node->occupied == 1);
-
-    leakentity = node->occupant;
-    return result;
-}
-
 /*
 ===========
 FillOutside
@@ -641,23 +602,51 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         filltype = settings::filltype_t::INSIDE;
     }
 
-    if (filltype == settings::filltype_t::INSIDE) {
-        BFSFloodFillFromOccupiedLeafs(occupied_clusters);
+    const leaf_graph_t graph = MakeLeafGraph(node);
 
-        /* first check to see if an occupied leaf is hit */
+    // a leaf which is in the void, but has a portal to outside_node
+    // NOTE: remember, the headnode has no relationship to the outside of the map.
+    size_t void_leaf;
+    {
         const int side = (tree.outside_node.portals->nodes[0] == &tree.outside_node);
         node_t *fillnode = tree.outside_node.portals->nodes[side];
 
-        if (fillnode->occupied > 0) {
-            leakline = MakeLeakLine(fillnode, leakentity);
+        Q_assert(fillnode != &tree.outside_node);
+
+        // this must be true because the map is made from closed brushes, beyond which is void
+        Q_assert(!LeafSealsMap(fillnode));
+        void_leaf = graph.index_of(fillnode);
+    }
+
+    if (filltype == settings::filltype_t::INSIDE) {
+        std::vector<size_t> sources;
+        for (node_t *leaf : occupied_clusters) {
+            sources.push_back(graph.index_of(leaf));
+        }
+
+        std::vector<int> occupied = FloodFillLeafGraph(graph, sources, 1);
+        for (size_t i = 0; i < graph.leafs.size(); i++) {
+            graph.leafs[i]->occupied = std::max(occupied[i], 0);
+        }
+
+        /* first check to see if an occupied leaf is hit */
+        if (occupied[void_leaf] > 0) {
+            size_t occupied_leaf = void_leaf;
+            leakline = WalkToNearestSource(graph, occupied, occupied_leaf, 1);
             std::reverse(leakline.begin(), leakline.end());
+
+            leakentity = graph.leafs[occupied_leaf]->occupant;
+            Q_assert(leakentity != nullptr);
         }
     } else {
         // Flood fill from outside -> in.
         //
         // We tried inside -> out and it leads to things like monster boxes getting inadvertently sealed,
         // or even whole sections of the map with no point entities - problems compounded by hull expansion.
-        FloodFillClustersFromVoid(tree);
+        std::vector<int> outside_distance = FloodFillLeafGraph(graph, {void_leaf}, 0);
+        for (size_t i = 0; i < graph.leafs.size(); i++) {
+            graph.leafs[i]->outside_distance = outside_distance[i];
+        }
 
         // check for the occupied leaf closest to the void
         int best_leak_dist = INT_MAX;
@@ -676,7 +665,8 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         if (best_leak) {
             leakentity = best_leak->occupant;
             Q_assert(leakentity != nullptr);
-            leakline = FindPortalsToVoid(best_leak);
+            size_t leak_leaf = graph.index_of(best_leak);
+            leakline = WalkToNearestSource(graph, outside_distance, leak_leaf, 0);
         }
     }
 
@@ -30,9 +30,10 @@
 #include <qbsp/tree.hh>
 #include <common/log.hh>
 #include <atomic>
+#include <iterator>
+#include <vector>
 
 #include "tbb/task_group.h"
-#include "common/vectorutils.hh"
 
 contentflags_t ClusterContents(const node_t *node)
 {
@@ -123,7 +124,7 @@ MakeHeadnodePortals
 The created portals will face the global outside_node
 ================
 */
-std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
+std::vector<buildportal_t> MakeHeadnodePortals(tree_t &tree)
 {
     int i, j, n;
     std::array<buildportal_t, 6> portals {};
@@ -179,7 +180,6 @@ std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
         }
     }
 
-    // move into std::list
     return { std::make_move_iterator(portals.begin()), std::make_move_iterator(portals.end()) };
 }
 
@@ -224,7 +224,7 @@ and clipping it by all of parents of this node, as well as all the other
 portals in the node.
 ==================
 */
-static std::optional<buildportal_t> MakeNodePortal(node_t *node, const std::list<buildportal_t> &boundary_portals, portalstats_t &stats)
+static std::optional<buildportal_t> MakeNodePortal(node_t *node, const std::vector<buildportal_t> &boundary_portals, portalstats_t &stats)
 {
     auto w = BaseWindingForNode(node);
 
@@ -272,13 +272,15 @@ Move or split the portals that bound node so that the node's
 children have portals instead of node.
 ==============
 */
-static twosided<std::list<buildportal_t>> SplitNodePortals(const node_t *node, std::list<buildportal_t> boundary_portals, portalstats_t &stats)
+static twosided<std::vector<buildportal_t>> SplitNodePortals(const node_t *node, std::vector<buildportal_t> boundary_portals, portalstats_t &stats)
 {
     const auto &plane = node->get_plane();
     node_t *f = node->children[0];
     node_t *b = node->children[1];
 
-    twosided<std::list<buildportal_t>> result;
+    twosided<std::vector<buildportal_t>> result;
+    result.front.reserve(boundary_portals.size());
+    result.back.reserve(boundary_portals.size());
 
     for (auto &p : boundary_portals) {
         // which side of p `node` is on
@@ -360,7 +362,7 @@ static twosided<std::list<buildportal_t>> SplitNodePortals(const node_t *node, s
 MakePortalsFromBuildportals
 ================
 */
-void MakePortalsFromBuildportals(tree_t &tree, std::list<buildportal_t> &buildportals)
+void MakePortalsFromBuildportals(tree_t &tree, std::vector<buildportal_t> &buildportals)
 {
     tree.portals.reserve(buildportals.size());
 
@@ -422,6 +424,45 @@ static void CalcTreeBounds_r(node_t *node, logging::percent_clock &clock)
     }
 }
 
+// subtrees with fewer nodes than this are portalized on the calling thread;
+// below this, spawning tasks costs more than it saves
+constexpr size_t PARALLEL_PORTAL_NODES = 256;
+
+// moves the contents of `from` onto the end of `to`
+static void AppendPortals(std::vector<buildportal_t> &to, std::vector<buildportal_t> &&from)
+{
+    if (to.empty()) {
+        to = std::move(from);
+        return;
+    }
+
+    to.insert(to.end(), std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+}
+
+/*
+==================
+CountSubtreeNodes_r
+
+Stores the number of nodes and leafs under each node, in preorder (front
+child first); the front child of the node at `index` is at `index + 1`, and
+the back child follows the front child's subtree.
+==================
+*/
+static size_t CountSubtreeNodes_r(const node_t *node, std::vector<size_t> &sizes)
+{
+    const size_t index = sizes.size();
+    sizes.push_back(1);
+
+    if (!node->is_leaf) {
+        size_t count = 1;
+        count += CountSubtreeNodes_r(node->children[0], sizes);
+        count += CountSubtreeNodes_r(node->children[1], sizes);
+        sizes[index] = count;
+    }
+
+    return sizes[index];
+}
+
 /*
 ==================
 ClipNodePortalToTree_r
@@ -432,7 +473,7 @@ descends the tree, splitting the portals as needed until they are connected to l
 The other side of the portals will remain untouched.
 ==================
 */
-static std::list<buildportal_t> ClipNodePortalsToTree_r(node_t *node, portaltype_t type, std::list<buildportal_t> portals, portalstats_t &stats)
+static std::vector<buildportal_t> ClipNodePortalsToTree_r(node_t *node, portaltype_t type, std::vector<buildportal_t> portals, portalstats_t &stats)
 {
     if (portals.empty()) {
         return portals;
@@ -443,22 +484,13 @@ static std::list<buildportal_t> ClipNodePortalsToTree_r(node_t *node, portaltype
 
     auto boundary_portals_split = SplitNodePortals(node, std::move(portals), stats);
 
-    auto front_fragments = ClipNodePortalsToTree_r(node->children[0], type, std::move(boundary_portals_split.front), stats);
-    auto back_fragments = ClipNodePortalsToTree_r(node->children[1], type, std::move(boundary_portals_split.back), stats);
-
-    std::list<buildportal_t> merged_result = std::move(front_fragments);
-    merged_result.splice(merged_result.end(), back_fragments);
+    auto merged_result = ClipNodePortalsToTree_r(node->children[0], type, std::move(boundary_portals_split.front), stats);
+    AppendPortals(merged_result, ClipNodePortalsToTree_r(node->children[1], type, std::move(boundary_portals_split.back), stats));
     return merged_result;
 }
 
-/*
-==================
-MakeTreePortals_r
-
-Given the list of portals bounding `node`, returns the portal list for a fully-portalized `node`.
-==================
-*/
-std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std::list<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock)
+static std::vector<buildportal_t> MakeSubtreePortals_r(node_t *node, size_t index, const std::vector<size_t> &subtree_sizes,
+    portaltype_t type, std::vector<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock)
 {
     clock();
 
@@ -474,35 +506,69 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
 
     auto boundary_portals_split = SplitNodePortals(node, std::move(boundary_portals), stats);
 
-    std::list<buildportal_t> result_portals_front, result_portals_back;
+    const size_t front_index = index + 1;
+    const size_t back_index = front_index + subtree_sizes[front_index];
+
+    std::vector<buildportal_t> result_portals_front, result_portals_back;
 
-    tbb::task_group g;
-    g.run([&]() { result_portals_front = MakeTreePortals_r(node->children[0], type, std::move(boundary_portals_split.front), stats, clock); });
-    g.run([&]() { result_portals_back = MakeTreePortals_r(node->children[1], type, std::move(boundary_portals_split.back), stats, clock); });
-    g.wait();
+    auto make_front = [&]() {
+        result_portals_front = MakeSubtreePortals_r(node->children[0], front_index, subtree_sizes, type,
+            std::move(boundary_portals_split.front), stats, clock);
+    };
+    auto make_back = [&]() {
+        result_portals_back = MakeSubtreePortals_r(node->children[1], back_index, subtree_sizes, type,
+            std::move(boundary_portals_split.back), stats, clock);
+    };
+
+    if (subtree_sizes[index] >= PARALLEL_PORTAL_NODES) {
+        tbb::task_group g;
+        g.run(make_front);
+        g.run(make_back);
+        g.wait();
+    } else {
+        make_front();
+        make_back();
+    }
 
     // sequential part: push the nodeportal down each side of the bsp so it connects leafs
 
-    std::list<buildportal_t> result_portals_onnode;
+    std::vector<buildportal_t> result_portals_onnode;
 
     if (nodeportal) {
         // to start with, `nodeportal` is a portal between node->children[0] and node->children[1]
+        std::vector<buildportal_t> node_portals;
+        node_portals.push_back(std::move(*nodeportal));
 
         // these portal fragments have node->children[1] on one side, and the leaf nodes from
         // node->children[0] on the other side
-        std::list<buildportal_t> half_clipped =
-            ClipNodePortalsToTree_r(node->children[0], type, make_list(std::move(*nodeportal)), stats);
+        std::vector<buildportal_t> half_clipped =
+            ClipNodePortalsToTree_r(node->children[0], type, std::move(node_portals), stats);
 
         result_portals_onnode = ClipNodePortalsToTree_r(node->children[1], type, std::move(half_clipped), stats);
     }
 
     // all done, merge together the lists and return
-    std::list<buildportal_t> merged_result = std::move(result_portals_front);
-    merged_result.splice(merged_result.end(), result_portals_back);
-    merged_result.splice(merged_result.end(), result_portals_onnode);
+    std::vector<buildportal_t> merged_result = std::move(result_portals_front);
+    AppendPortals(merged_result, std::move(result_portals_back));
+    AppendPortals(merged_result, std::move(result_portals_onnode));
     return merged_result;
 }
 
+/*
+==================
+MakeTreePortals_r
+
+Given the list of portals bounding `node`, returns the portal list for a fully-portalized `node`.
+==================
+*/
+std::vector<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std::vector<buildportal_t> boundary_portals, portalstats_t &stats, logging::percent_clock &clock)
+{
+    std::vector<size_t> subtree_sizes;
+    CountSubtreeNodes_r(node, subtree_sizes);
+
+    return MakeSubtreePortals_r(node, 0, subtree_sizes, type, std::move(boundary_portals), stats, clock);
+}
+
 /*
 ==================
 MakeTreePortals
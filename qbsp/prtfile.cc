@@ -22,6 +22,7 @@
 #include <qbsp/prtfile.hh>
 
 #include <common/log.hh>
+#include <common/prtfile.hh>
 #include <qbsp/map.hh>
 #include <qbsp/portals.hh>
 #include <qbsp/qbsp.hh>
@@ -46,16 +47,23 @@ static void WriteFloat(std::ofstream &portalFile, vec_t v)
         fmt::print(portalFile, "{} ", v);
 }
 
-static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool clusters)
+/*
+================
+CollectPortals_r
+
+Gathers the vis portals in the order they are written to the portal file.
+================
+*/
+static void CollectPortals_r(node_t *node, prtfile_t &prtfile, bool clusters)
 {
     const portal_t *p, *next;
-    const winding_t* w;
-    int i, front, back;
+    const winding_t *w;
+    int front, back;
     qplane3d plane2;
 
     if (!node->is_leaf && !node->detail_separator) {
-        WritePortals_r(node->children[0], portalFile, clusters);
-        WritePortals_r(node->children[1], portalFile, clusters);
+        CollectPortals_r(node->children[0], prtfile, clusters);
+        CollectPortals_r(node->children[1], prtfile, clusters);
         return;
     }
     if (node->contents.is_solid(qbsp_options.target_game))
@@ -75,6 +83,9 @@ static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool cluster
         Q_assert(front != -1);
         Q_assert(back != -1);
 
+        prtfile_portal_t &out = prtfile.portals.emplace_back();
+        out.winding = prtfile_winding_t(w->begin(), w->end());
+
         /*
          * sometimes planes get turned around when they are very near the
          * changeover point between different axis.  interpret the plane the
@@ -82,16 +93,45 @@ static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool cluster
          */
         plane2 = w->plane();
         if (qv::dot(p->plane.get_normal(), plane2.normal) < 1.0 - ANGLEEPSILON) {
-            fmt::print(portalFile, "{} {} {} ", w->size(), back, front);
+            out.leafnums[0] = back;
+            out.leafnums[1] = front;
         } else {
-            fmt::print(portalFile, "{} {} {} ", w->size(), front, back);
+            out.leafnums[0] = front;
+            out.leafnums[1] = back;
         }
+    }
+}
+
+/*
+================
+CollectClusters_r
+
+Fills in the leaf -> cluster map of a PRT2 file.
+================
+*/
+static void CollectClusters_r(node_t *node, prtfile_t &prtfile)
+{
+    if (!node->is_leaf) {
+        CollectClusters_r(node->children[0], prtfile);
+        CollectClusters_r(node->children[1], prtfile);
+        return;
+    }
+    if (node->contents.is_solid(qbsp_options.target_game))
+        return;
+
+    prtfile.dleafinfos[node->visleafnum + 1].cluster = node->viscluster;
+}
+
+static void WritePortals(const prtfile_t &prtfile, std::ofstream &portalFile)
+{
+    for (auto &p : prtfile.portals) {
+        fmt::print(portalFile, "{} {} {} ", p.winding.size(), p.leafnums[0], p.leafnums[1]);
 
-        for (i = 0; i < w->size(); i++) {
+        for (auto &point : p.winding) {
             fmt::print(portalFile, "(");
-            WriteFloat(portalFile, w->at(i)[0]);
-            WriteFloat(portalFile, w->at(i)[1]);
-            WriteFloat(portalFile, w->at(i)[2]);
+            WriteFloat(portalFile, point[0]);
+            WriteFloat(portalFile, point[1]);
+            WriteFloat(portalFile, point[2]);
             fmt::print(portalFile, ") ");
         }
         fmt::print(portalFile, "\n");
@@ -200,45 +240,72 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
      */
     NumberLeafs_r(headnode, state, -1);
 
+    const int num_visleafs = state.num_visleafs.count.load();
+    const int num_visclusters = state.num_visclusters.count.load();
+    const int num_visportals = state.num_visportals.count.load();
+
+    /*
+     * Gather the portal file the way vis will load it. q2 uses a PRT1 file,
+     * but with clusters. (Since q2bsp natively supports clusters, we don't
+     * need PRT2.)
+     */
+    const bool is_q2 = qbsp_options.target_game->id == GAME_QUAKE_II;
+    const bool is_prt2 = !is_q2 && state.uses_detail && !qbsp_options.forceprt1.value();
+    const bool clusters = is_q2 || state.uses_detail;
+
+    prtfile_t prtfile{};
+    prtfile.portals.reserve(num_visportals);
+    CollectPortals_r(headnode, prtfile, clusters);
+
+    if (is_q2) {
+        prtfile.portalleafs = num_visclusters;
+        prtfile.portalleafs_real = 0;
+    } else if (is_prt2) {
+        prtfile.portalleafs = num_visclusters;
+        prtfile.portalleafs_real = num_visleafs;
+        prtfile.dleafinfos.resize(num_visleafs + 1);
+        CollectClusters_r(headnode, prtfile);
+    } else {
+        /* PRT1, or a PRT1 forced for the map editor that vis will reject */
+        prtfile.portalleafs = prtfile.portalleafs_real = clusters ? num_visclusters : num_visleafs;
+        prtfile.dleafinfos.resize(prtfile.portalleafs + 1);
+        for (int i = 0; i < prtfile.portalleafs; i++) {
+            prtfile.dleafinfos[i + 1].cluster = i;
+        }
+    }
+
     // write the file
     fs::path name = qbsp_options.bsp_path;
     name.replace_extension("prt");
 
-    std::ofstream portalFile(name, std::ios_base::out);
-    if (!portalFile)
-        FError("Failed to open {}: {}", name, strerror(errno));
+    if (qbsp_options.memoryprt.value()) {
+        StorePrtFileInMemory(name, std::move(prtfile));
+        return;
+    }
 
-    // q2 uses a PRT1 file, but with clusters.
-    // (Since q2bsp natively supports clusters, we don't need PRT2.)
-    if (qbsp_options.target_game->id == GAME_QUAKE_II) {
-        fmt::print(portalFile, "PRT1\n");
-        fmt::print(portalFile, "{}\n", state.num_visclusters.count.load());
-        fmt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, true);
+    if (qbsp_options.binaryprt.value()) {
+        WriteBinaryPrtFile(name, prtfile);
         return;
     }
 
-    /* If no detail clusters, just use a normal PRT1 format */
-    if (!state.uses_detail) {
-        fmt::print(portalFile, "PRT1\n");
-        fmt::print(portalFile, "{}\n", state.num_visleafs.count.load());
-        fmt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, false);
-    } else if (qbsp_options.forceprt1.value()) {
-        /* Write a PRT1 file for loading in the map editor. Vis will reject it. */
+    std::ofstream portalFile(name, std::ios_base::out);
+    if (!portalFile)
+        FError("Failed to open {}: {}", name, strerror(errno));
+
+    if (!is_prt2) {
         fmt::print(portalFile, "PRT1\n");
-        fmt::print(portalFile, "{}\n", state.num_visclusters.count.load());
-        fmt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, true);
+        fmt::print(portalFile, "{}\n", prtfile.portalleafs);
+        fmt::print(portalFile, "{}\n", num_visportals);
+        WritePortals(prtfile, portalFile);
     } else {
         /* Write a PRT2 */
         fmt::print(portalFile, "PRT2\n");
-        fmt::print(portalFile, "{}\n", state.num_visleafs.count.load());
-        fmt::print(portalFile, "{}\n", state.num_visclusters.count.load());
-        fmt::print(portalFile, "{}\n", state.num_visportals.count.load());
-        WritePortals_r(headnode, portalFile, true);
+        fmt::print(portalFile, "{}\n", num_visleafs);
+        fmt::print(portalFile, "{}\n", num_visclusters);
+        fmt::print(portalFile, "{}\n", num_visportals);
+        WritePortals(prtfile, portalFile);
         check = WriteClusters_r(headnode, portalFile, 0);
-        if (check != state.num_visclusters.count.load() - 1) {
+        if (check != num_visclusters - 1) {
             FError("Internal error: Detail cluster mismatch");
         }
         fmt::print(portalFile, "-1\n");
@@ -24,6 +24,7 @@
 #include <algorithm>
 
 #include <common/log.hh>
+#include <common/prtfile.hh>
 #include <common/aabb.hh>
 #include <common/fs.hh>
 #include <common/settings.hh>
@@ -450,6 +451,8 @@ qbsp_settings::qbsp_settings()
           "uses alternate texture alignment which was default in tyrutils-ericw v0.15.1 and older"},
       forcegoodtree{
           this, "forcegoodtree", false, &debugging_group, "force use of expensive processing for BrushBSP stage"},
+      sahsplit{this, "sahsplit", false, &debugging_group,
+          "use a binned surface area heuristic instead of the midsplit method for large nodes and simple models in the BrushBSP stage"},
       midsplitsurffraction{this, "midsplitsurffraction", 0.f, 0.f, 1.f, &debugging_group,
           "if 0 (default), use `maxnodesize` for deciding when to switch to midsplit bsp heuristic.\nif 0 < midsplitSurfFraction <= 1, switch to midsplit if the node contains more than this fraction of the model's\ntotal surfaces. Try 0.15 to 0.5. Works better than maxNodeSize for maps with a 3D skybox (e.g. +-128K unit maps)"},
       maxnodesize{this, "maxnodesize", 1024, &debugging_group,
@@ -477,6 +480,10 @@ qbsp_settings::qbsp_settings()
       leakdist{this, "leakdist", 2, &debugging_group, "space between leakfile points"},
       forceprt1{
           this, "forceprt1", false, &debugging_group, "force a PRT1 output file even if PRT2 is required for vis"},
+      binaryprt{this, "binaryprt", false, &common_format_group,
+          "write the .prt file in a binary format that vis loads faster (map editors can't read it)"},
+      memoryprt{this, "memoryprt", false, &debugging_group,
+          "keep the .prt file in memory for a vis run in the same process instead of writing it"},
       tjunc{this, {"tjunc", "notjunc"}, tjunclevel_t::MWT,
           {{"none", tjunclevel_t::NONE}, {"rotate", tjunclevel_t::ROTATE}, {"retopologize", tjunclevel_t::RETOPOLOGIZE},
               {"mwt", tjunclevel_t::MWT}},
@@ -815,14 +822,15 @@ static bool IsTrigger(const mapentity_t &entity)
     return trigger_pos == (tex.size() - strlen("trigger"));
 }
 
-static void CountLeafs_r(node_t *node, content_stats_base_t &stats)
+static void CountLeafs_r(node_t *node, content_stats_base_t &stats, size_t &num_nodes)
 {
     if (node->is_leaf) {
         qbsp_options.target_game->count_contents_in_stats(node->contents, stats);
         return;
     }
-    CountLeafs_r(node->children[0], stats);
-    CountLeafs_r(node->children[1], stats);
+    num_nodes++;
+    CountLeafs_r(node->children[0], stats, num_nodes);
+    CountLeafs_r(node->children[1], stats, num_nodes);
 }
 
 static int NodeHeight(node_t* node)
@@ -848,11 +856,13 @@ void CountLeafs(node_t *headnode)
     logging::funcheader();
 
     auto stats = qbsp_options.target_game->create_content_stats();
-    CountLeafs_r(headnode, *stats);
+    size_t num_nodes = 0;
+    CountLeafs_r(headnode, *stats, num_nodes);
     qbsp_options.target_game->print_content_stats(*stats, "leafs");
 
     // count the heights of the tree at each leaf
     logging::stat_tracker_t stat_print;
+    stat_print.register_stat("nodes").count += num_nodes;
 
     std::vector<int> leaf_heights;
     CountLeafHeights_r(headnode, leaf_heights);
@@ -988,10 +998,13 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         return;
     }
 
+    // the cheap split method, for hulls and brush models
+    const tree_split_t fast_split_type = qbsp_options.sahsplit.value() ? tree_split_t::SAH : tree_split_t::FAST;
+
     // simpler operation for hulls
     if (hullnum.value_or(0)) {
         tree_t tree;
-        BrushBSP(tree, entity, brushes, tree_split_t::FAST);
+        BrushBSP(tree, entity, brushes, fast_split_type);
         if (map.is_world_entity(entity) && !qbsp_options.nofill.value()) {
             // assume non-world bmodels are simple
             MakeTreePortals(tree);
@@ -1017,7 +1030,7 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
 
     BrushBSP(tree, entity, brushes,
         qbsp_options.forcegoodtree.value() ? tree_split_t::PRECISE : // we asked for the slow method
-        !map.is_world_entity(entity) ? tree_split_t::FAST : // brush models are assumed to be simple
+        !map.is_world_entity(entity) ? fast_split_type : // brush models are assumed to be simple
         tree_split_t::AUTO);
 
     // build all the portals in the bsp tree
@@ -1566,6 +1579,7 @@ void InitQBSP(int argc, const char **argv)
         fs::path prtfile = qbsp_options.bsp_path;
         prtfile.replace_extension("prt");
         remove(prtfile);
+        ClearPrtFileInMemory();
 
         fs::path ptsfile = qbsp_options.bsp_path;
         ptsfile.replace_extension("pts");
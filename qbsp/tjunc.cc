@@ -23,6 +23,7 @@
 #include <qbsp/qbsp.hh>
 #include <qbsp/map.hh>
 #include <atomic>
+#include <algorithm>
 
 struct tjunc_stats_t : logging::stat_tracker_t
 {
@@ -39,6 +40,10 @@ struct tjunc_stats_t : logging::stat_tracker_t
     stat &trimwt = register_stat("triangles computed from MWT");
     // # of faces added by MWT
     stat &facemwt = register_stat("faces created via optimization of MWT triangles");
+    // # of faces with too many vertices for MWT
+    stat &mwtskipped = register_stat("faces too large for MWT");
+    // # of triangles computed by ear clipping the faces too large for MWT
+    stat &triearclip = register_stat("triangles computed from ear clipping");
     // # of faces that could be successfully retopologized
     stat &retopology = register_stat("faces re-topologized");
     // # of faces generated by retopologization
@@ -139,31 +144,90 @@ static void FindEdgeVerts_BruteForce(
 
 /*
 ==========
-FindEdgeVerts_FaceBounds_R
+tjunc_vertex_index_t
 
-Recursive function for matching nodes that intersect the aabb
-for vertex checking.
+The vertices of every face in the tree, stored as an implicit kd-tree:
+each range's median is split on axis `depth % 3`, with the lower half
+before it and the upper half after it.
 ==========
 */
-static void FindEdgeVerts_FaceBounds_R(const node_t *node, const aabb3d &aabb, std::vector<size_t> &verts)
+struct tjunc_vertex_index_t
 {
-    if (node->is_leaf) {
-        return;
-    } else if (node->bounds.disjoint(aabb, 0.0)) {
-        return;
+    std::vector<size_t> verts;
+    std::vector<qvec3d> points;
+
+    tjunc_vertex_index_t(std::vector<size_t> face_verts)
+    {
+        std::sort(face_verts.begin(), face_verts.end());
+        face_verts.erase(std::unique(face_verts.begin(), face_verts.end()), face_verts.end());
+
+        verts = std::move(face_verts);
+        build(0, verts.size(), 0);
+
+        points.reserve(verts.size());
+
+        for (auto &v : verts) {
+            points.push_back(map.bsp.dvertexes[v]);
+        }
     }
 
-    for (auto &face : node->facelist) {
-        for (auto &v : face->original_vertices) {
-            if (aabb.containsPoint(map.bsp.dvertexes[v])) {
-                verts.push_back(v);
-            }
+    /*
+    ==========
+    find
+
+    Adds every vertex inside `bounds` to `out`, in index order.
+    ==========
+    */
+    void find(const aabb3d &bounds, std::vector<size_t> &out) const
+    {
+        size_t first = out.size();
+
+        find_r(0, verts.size(), 0, bounds, out);
+
+        // the tree order depends on where the vertices are; keep the
+        // output independent of that
+        std::sort(out.begin() + first, out.end());
+    }
+
+private:
+    void build(size_t start, size_t end, size_t depth)
+    {
+        if (end - start <= 1) {
+            return;
         }
+
+        const size_t axis = depth % 3;
+        const size_t mid = start + (end - start) / 2;
+
+        std::nth_element(verts.begin() + start, verts.begin() + mid, verts.begin() + end,
+            [axis](size_t a, size_t b) { return map.bsp.dvertexes[a][axis] < map.bsp.dvertexes[b][axis]; });
+
+        build(start, mid, depth + 1);
+        build(mid + 1, end, depth + 1);
     }
 
-    FindEdgeVerts_FaceBounds_R(node->children[0], aabb, verts);
-    FindEdgeVerts_FaceBounds_R(node->children[1], aabb, verts);
-}
+    void find_r(size_t start, size_t end, size_t depth, const aabb3d &bounds, std::vector<size_t> &out) const
+    {
+        if (start >= end) {
+            return;
+        }
+
+        const size_t axis = depth % 3;
+        const size_t mid = start + (end - start) / 2;
+        const qvec3d &p = points[mid];
+
+        if (bounds.containsPoint(p)) {
+            out.push_back(verts[mid]);
+        }
+
+        if (bounds.mins()[axis] <= p[axis]) {
+            find_r(start, mid, depth + 1, bounds, out);
+        }
+        if (bounds.maxs()[axis] >= p[axis]) {
+            find_r(mid + 1, end, depth + 1, bounds, out);
+        }
+    }
+};
 
 /*
 ==========
@@ -173,12 +237,9 @@ Use a loose AABB around the line and only capture vertices that intersect it.
 ==========
 */
 static void FindEdgeVerts_FaceBounds(
-    const node_t *headnode, const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
+    const tjunc_vertex_index_t &index, const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
 {
-    // magic number, average of "usual" points per edge
-    verts.reserve(8);
-
-    FindEdgeVerts_FaceBounds_R(headnode, (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), verts);
+    index.find((aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), verts);
 }
 
 /*
@@ -248,7 +309,7 @@ Generate a superface (the input face `f` but with all of the
 verts in the world added that lay on the line) and return it
 ==================
 */
-static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static std::vector<size_t> CreateSuperFace(const tjunc_vertex_index_t &index, face_t *f, tjunc_stats_t &stats)
 {
     std::vector<size_t> superface;
 
@@ -268,7 +329,7 @@ static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_st
         qvec3d e2 = map.bsp.dvertexes[v2];
 
         edge_verts.clear();
-        FindEdgeVerts_FaceBounds(headnode, edge_start, e2, edge_verts);
+        FindEdgeVerts_FaceBounds(index, edge_start, e2, edge_verts);
 
         vec_t len;
         qvec3d edge_dir = qv::normalize(e2 - edge_start, len);
@@ -442,6 +503,10 @@ static std::list<std::vector<size_t>> compress_triangles_into_fans(
 
 #include <queue>
 
+// faces with more vertices than this skip MWT, since it's O(n^3); they're
+// ear clipped instead
+constexpr size_t MWT_MAX_VERTICES = 256;
+
 // Function to calculate the weight of optimal triangulation of a convex polygon
 // represented by a given set of vertices
 std::vector<qvectri> minimum_weight_triangulation(
@@ -450,11 +515,39 @@ std::vector<qvectri> minimum_weight_triangulation(
     // get the number of vertices in the polygon
     size_t n = vertices.size();
 
+    // the edge lengths and directions, which every triangle
+    // would otherwise recompute. `D[i + (j * n)]` is the 2D length of `ij`,
+    // `dir[i + (j * n)]` the 3D unit vector from `i` to `j`.
+    std::vector<vec_t> D(n * n);
+    std::vector<qvec3d> dir(n * n);
+
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            D[i + (j * n)] = D[j + (i * n)] = qv::distance(vertices[i], vertices[j]);
+
+            qvec3d delta = map.bsp.dvertexes[indices[j]] - map.bsp.dvertexes[indices[i]];
+            // left as NaN for coincident points, same as AngleOfTriangle
+            dir[i + (j * n)] = delta / qv::length(delta);
+            dir[j + (i * n)] = -dir[i + (j * n)];
+        }
+    }
+
+    // same as TriangleIsValid(..., 0.01), but on the cached directions:
+    // an angle is under 0.01 degrees if the cosine is above this
+    const vec_t max_cos = cos(0.01 * (3.141592653589793238463 / 180.0));
+
+    auto triangle_is_valid = [&](size_t a, size_t b, size_t c) {
+        return !(qv::dot(dir[a + (b * n)], dir[a + (c * n)]) > max_cos ||
+                 qv::dot(dir[b + (c * n)], dir[b + (a * n)]) > max_cos ||
+                 qv::dot(dir[c + (a * n)], dir[c + (b * n)]) > max_cos);
+    };
+
     // create a table for storing the solutions to subproblems
     // `T[i][j]` stores the weight of the minimum-weight triangulation
     // of the polygon below edge `ij`
+    constexpr uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
     std::vector<vec_t> T(n * n);
-    std::vector<std::optional<size_t>> K(n * n);
+    std::vector<uint32_t> K(n * n, NO_VERTEX);
 
     // fill the table diagonally using the recurrence relation
     for (size_t diagonal = 0; diagonal < n; diagonal++) {
@@ -464,28 +557,30 @@ std::vector<qvectri> minimum_weight_triangulation(
                 continue;
             }
 
-            T[i + (j * n)] = std::numeric_limits<vec_t>::max();
+            vec_t t_weight = std::numeric_limits<vec_t>::max();
+            uint32_t t_k = NO_VERTEX;
+            const vec_t d_ij = D[i + (j * n)];
 
             // consider all possible triangles `ikj` within the polygon
             for (size_t k = i + 1; k <= j - 1; k++) {
                 // The weight of triangulation is the length of its perimeter
                 vec_t weight;
 
-                if (!TriangleIsValid(indices[i], indices[j], indices[k], 0.01)) {
+                if (!triangle_is_valid(i, j, k)) {
                     weight = std::nexttoward(std::numeric_limits<vec_t>::max(), 0.0);
                 } else {
-                    weight = (qv::distance(vertices[i], vertices[j]) + qv::distance(vertices[j], vertices[k]) +
-                                 qv::distance(vertices[k], vertices[i])) +
-                             T[i + (k * n)] + T[k + (j * n)];
+                    weight = (d_ij + D[j + (k * n)] + D[k + (i * n)]) + T[i + (k * n)] + T[k + (j * n)];
                 }
-                vec_t &t_weight = T[i + (j * n)];
 
                 // choose vertex `k` that leads to the minimum total weight
                 if (weight < t_weight) {
                     t_weight = weight;
-                    K[i + (j * n)] = k;
+                    t_k = static_cast<uint32_t>(k);
                 }
             }
+
+            T[i + (j * n)] = t_weight;
+            K[i + (j * n)] = t_k;
         }
     }
 
@@ -501,18 +596,18 @@ std::vector<qvectri> minimum_weight_triangulation(
             continue;
         }
 
-        auto &c = K[edge[0] + (edge[1] * n)];
+        const uint32_t c = K[edge[0] + (edge[1] * n)];
 
-        if (!c.has_value()) {
+        if (c == NO_VERTEX) {
             continue;
         }
 
-        qvectri tri{edge[0], edge[1], c.value()};
+        qvectri tri{edge[0], edge[1], c};
         std::sort(tri.begin(), tri.end());
         triangles.emplace_back(tri);
 
-        edge_queue.emplace(edge[0], c.value());
-        edge_queue.emplace(c.value(), edge[1]);
+        edge_queue.emplace(edge[0], c);
+        edge_queue.emplace(c, edge[1]);
     }
 
     Q_assert(triangles.size() == n - 2);
@@ -520,9 +615,118 @@ std::vector<qvectri> minimum_weight_triangulation(
     return triangles;
 }
 
+/*
+==================
+ear_clip_face
+
+O(n^2) stand-in for MWT on faces too large for it. Repeatedly
+clips the ear with the shortest new edge (the greedy version of
+MWT's weight); ears clipped one after another around the same
+vertex are kept together as one fan. Returns an empty list if it
+runs out of valid ears.
+==================
+*/
+static std::list<std::vector<size_t>> ear_clip_face(const std::vector<size_t> &vertices, tjunc_stats_t &stats)
+{
+    const size_t n = vertices.size();
+    constexpr size_t NO_VERTEX = std::numeric_limits<size_t>::max();
+
+    // the remaining polygon, as a ring of indices into `vertices`
+    std::vector<size_t> prev(n), next(n);
+
+    for (size_t i = 0; i < n; i++) {
+        prev[i] = (i + n - 1) % n;
+        next[i] = (i + 1) % n;
+    }
+
+    // true if `point` lays on the edge from `start` to `end`
+    auto on_edge = [](size_t point, size_t start, size_t end) {
+        float len;
+        qvec3d dir = qv::normalize(map.bsp.dvertexes[end] - map.bsp.dvertexes[start], len);
+        return PointOnEdge(map.bsp.dvertexes[point], map.bsp.dvertexes[start], dir, 0, len).has_value();
+    };
+
+    auto ear_is_valid = [&](size_t i, size_t remaining) {
+        const size_t p = prev[i], nx = next[i];
+
+        if (!TriangleIsValid(vertices[p], vertices[i], vertices[nx], 0.01)) {
+            return false;
+        }
+
+        // if a neighbour lays on the new edge, what's left would
+        // have a zero-area triangle in it
+        if (remaining > 3 &&
+            (on_edge(vertices[next[nx]], vertices[p], vertices[nx]) ||
+                on_edge(vertices[prev[p]], vertices[p], vertices[nx]))) {
+            return false;
+        }
+
+        return true;
+    };
+
+    std::list<std::vector<size_t>> result;
+    // the fan the last ear went into, and the vertex whose ear would continue it
+    std::vector<size_t> *fan = nullptr;
+    size_t fan_next = NO_VERTEX;
+    size_t start = 0;
+
+    for (size_t remaining = n; remaining >= 3; remaining--) {
+        size_t ear = NO_VERTEX;
+
+        if (fan && ear_is_valid(fan_next, remaining)) {
+            ear = fan_next;
+        } else {
+            fan = nullptr;
+
+            vec_t best_weight = std::numeric_limits<vec_t>::max();
+
+            for (size_t i = start, k = 0; k < remaining; i = next[i], k++) {
+                if (!ear_is_valid(i, remaining)) {
+                    continue;
+                }
+
+                vec_t weight = qv::distance(map.bsp.dvertexes[vertices[prev[i]]], map.bsp.dvertexes[vertices[next[i]]]);
+
+                if (weight < best_weight) {
+                    best_weight = weight;
+                    ear = i;
+                }
+            }
+
+            if (ear == NO_VERTEX) {
+                return {};
+            }
+        }
+
+        const size_t p = prev[ear], nx = next[ear];
+
+        if (fan) {
+            fan->push_back(vertices[nx]);
+        } else {
+            fan = &result.emplace_back(std::vector<size_t>{vertices[p], vertices[ear], vertices[nx]});
+        }
+
+        // the next ear around `p` is at `nx`
+        fan_next = nx;
+        start = nx;
+
+        next[p] = nx;
+        prev[nx] = p;
+    }
+
+    stats.triearclip += n - 2;
+
+    return result;
+}
+
 static std::list<std::vector<size_t>> mwt_face(
     const face_t *f, const std::vector<size_t> &vertices, tjunc_stats_t &stats)
 {
+    if (vertices.size() > MWT_MAX_VERTICES) {
+        stats.mwtskipped++;
+        return ear_clip_face(vertices, stats);
+    }
+
     const auto &p = f->get_plane();
     auto [u, v] = qv::MakeTangentAndBitangentUnnormalized(p.get_normal());
     qv::normalizeInPlace(u);
@@ -707,7 +911,7 @@ FixFaceEdges
 If the face has any T-junctions, fix them here.
 ==================
 */
-static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static void FixFaceEdges(const tjunc_vertex_index_t &index, face_t *f, tjunc_stats_t &stats)
 {
     // we were asked not to bother fixing any of the faces.
     if (qbsp_options.tjunc.value() == settings::tjunclevel_t::NONE) {
@@ -715,7 +919,7 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
         return;
     }
 
-    std::vector<size_t> superface = CreateSuperFace(headnode, f, stats);
+    std::vector<size_t> superface = CreateSuperFace(index, f, stats);
 
     if (superface.size() < 3) {
         // entire face collapsed
@@ -863,5 +1067,14 @@ void TJunc(node_t *headnode)
 
     FindFaces_r(headnode, faces);
 
-    logging::parallel_for_each(faces, [&](auto &face) { FixFaceEdges(headnode, face, stats); });
+    // only vertices of faces in this tree can cause T-junctions on it
+    std::vector<size_t> face_verts;
+
+    for (auto &face : faces) {
+        face_verts.insert(face_verts.end(), face->original_vertices.begin(), face->original_vertices.end());
+    }
+
+    const tjunc_vertex_index_t index(std::move(face_verts));
+
+    logging::parallel_for_each(faces, [&](auto &face) { FixFaceEdges(index, face, stats); });
 }
@@ -32,7 +32,9 @@
 
 portal_t *tree_t::create_portal()
 {
-    return portals.emplace_back(std::make_unique<portal_t>()).get();
+    auto it = portals.emplace_back();
+
+    return &(*it);
 }
 
 node_t *tree_t::create_node()
@@ -68,8 +70,6 @@ static void ClearNodePortals_r(node_t *node)
     node->portals = nullptr;
 }
 
-#include <tbb/parallel_for_each.h>
-
 void FreeTreePortals(tree_t &tree)
 {
     if (tree.headnode) {
@@ -77,10 +77,6 @@ void FreeTreePortals(tree_t &tree)
         tree.outside_node.portals = nullptr;
     }
 
-    tbb::parallel_for_each(tree.portals, [](std::unique_ptr<portal_t> &portal) {
-        portal.reset();
-    });
-
     tree.portals.clear();
 }
 
@@ -2,6 +2,8 @@
 #include <doctest/doctest.h>
 #include <common/qvec.hh>
 #include <common/polylib.hh>
+#include <qbsp/brush.hh>
+#include "test_qbsp.hh"
 
 #include <array>
 #include <vector>
@@ -80,3 +82,95 @@ TEST_CASE("SplitFace" * doctest::test_suite("benchmark"))
     // run with doctest assertions, to validate that they actually work
     test_polylib(true);
 }
+
+template<typename MakeFn>
+static void test_brush_fragments(MakeFn &&make_fn)
+{
+    // roughly what SplitBrush produces: a pair of six-sided fragments
+    for (int i = 0; i < 2; i++) {
+        bspbrush_t::ptr b = make_fn();
+        b->sides.resize(6);
+
+        for (auto &side : b->sides) {
+            side.w = polylib::winding_t(4);
+        }
+
+        ankerl::nanobench::doNotOptimizeAway(b);
+    }
+}
+
+TEST_CASE("bspbrush_t allocation" * doctest::test_suite("benchmark"))
+{
+    ankerl::nanobench::Bench bench;
+
+    bench.run("std::make_shared<bspbrush_t>", [&] {
+        test_brush_fragments([]() { return std::make_shared<bspbrush_t>(); });
+    });
+    bench.run("bspbrush_t::make_ptr (scalable_allocator)", [&] {
+        test_brush_fragments([]() { return bspbrush_t::make_ptr(); });
+    });
+}
+
+static void bench_classify_points(size_t count)
+{
+    std::vector<qvec3d> points;
+    for (size_t i = 0; i < count; i++) {
+        const double a = (2.0 * Q_PI * i) / count;
+        points.push_back({cos(a) * 64.0, sin(a) * 64.0, 16.0 + (i % 3)});
+    }
+
+    const qplane3d plane({0.6, 0.8, 0.0}, 8.0);
+    std::vector<vec_t> dists(count);
+    std::vector<planeside_t> sides(count);
+
+    ankerl::nanobench::Bench bench;
+    bench.relative(true);
+
+    bench.run(fmt::format("distance_to loop ({} points)", count), [&] {
+        std::array<size_t, SIDE_TOTAL> counts{};
+        for (size_t i = 0; i < count; i++) {
+            const vec_t d = plane.distance_to(points[i]);
+            dists[i] = d;
+            sides[i] = d > DEFAULT_ON_EPSILON ? SIDE_FRONT : d < -DEFAULT_ON_EPSILON ? SIDE_BACK : SIDE_ON;
+            counts[sides[i]]++;
+        }
+        ankerl::nanobench::doNotOptimizeAway(counts);
+    });
+    bench.run(fmt::format("qv::classify_points ({} points)", count), [&] {
+        auto result = qv::classify_points(points.data(), count, plane, DEFAULT_ON_EPSILON, dists.data(), sides.data());
+        ankerl::nanobench::doNotOptimizeAway(result);
+    });
+}
+
+TEST_CASE("classify_points" * doctest::test_suite("benchmark"))
+{
+    bench_classify_points(8);
+    bench_classify_points(24);
+    bench_classify_points(64);
+}
+
+TEST_CASE("tjunc_many_sided_face" * doctest::test_suite("benchmark"))
+{
+    // the whole compile is timed, but the many-sided ceiling makes tjunc the bulk of it
+    ankerl::nanobench::Bench bench;
+    bench.epochs(1);
+
+    bench.run("qbsp_tjunc_many_sided_face.map -tjunc mwt", [&] {
+        auto result = LoadTestmapQ1("qbsp_tjunc_many_sided_face.map", {"-tjunc", "mwt"});
+        ankerl::nanobench::doNotOptimizeAway(result);
+    });
+    bench.run("qbsp_tjunc_many_sided_face.map -tjunc retopologize", [&] {
+        auto result = LoadTestmapQ1("qbsp_tjunc_many_sided_face.map", {"-tjunc", "retopologize"});
+        ankerl::nanobench::doNotOptimizeAway(result);
+    });
+
+    // over MWT_MAX_VERTICES, so mwt ear clips the floor and ceiling
+    bench.run("qbsp_tjunc_ear_clip.map -tjunc mwt", [&] {
+        auto result = LoadTestmapQ1("qbsp_tjunc_ear_clip.map", {"-tjunc", "mwt"});
+        ankerl::nanobench::doNotOptimizeAway(result);
+    });
+    bench.run("qbsp_tjunc_ear_clip.map -tjunc retopologize", [&] {
+        auto result = LoadTestmapQ1("qbsp_tjunc_ear_clip.map", {"-tjunc", "retopologize"});
+        ankerl::nanobench::doNotOptimizeAway(result);
+    });
+}
@@ -4,6 +4,12 @@
 #include <common/bspfile.hh>
 #include <common/bspfile_q1.hh>
 #include <common/bspfile_q2.hh>
+#include <common/fs.hh>
+#include <common/prtfile.hh>
+
+#include <cstring>
+#include <fstream>
+#include <tbb/parallel_for.h>
 
 TEST_SUITE("common") {
 
@@ -126,4 +132,131 @@ TEST_CASE("q2 contents")
     }
 }
 
+TEST_CASE("binary prt file")
+{
+    prtfile_t prtfile{};
+    prtfile.portalleafs = 2;
+    prtfile.portalleafs_real = 3;
+
+    // a point that a text .prt would round, and a winding that spills out of the hybrid storage's array
+    auto &p0 = prtfile.portals.emplace_back();
+    p0.winding = prtfile_winding_t{{0.1, 0, 0}, {0, 64, 0}, {0, 64, 64}};
+    p0.leafnums[0] = 0;
+    p0.leafnums[1] = 1;
+
+    auto &p1 = prtfile.portals.emplace_back();
+    p1.winding.resize(PRT_MAX_WINDING_FIXED + 2);
+    for (size_t i = 0; i < p1.winding.size(); i++) {
+        p1.winding[i] = {static_cast<double>(i), 1.0 / 3.0, -2};
+    }
+    p1.leafnums[0] = 1;
+    p1.leafnums[1] = 2;
+
+    prtfile.dleafinfos = {{0}, {0}, {1}, {1}};
+
+    auto check_equal = [&](const prtfile_t &loaded) {
+        CHECK(loaded.portalleafs == prtfile.portalleafs);
+        CHECK(loaded.portalleafs_real == prtfile.portalleafs_real);
+        REQUIRE(loaded.portals.size() == prtfile.portals.size());
+
+        for (size_t i = 0; i < prtfile.portals.size(); i++) {
+            CHECK(loaded.portals[i].leafnums[0] == prtfile.portals[i].leafnums[0]);
+            CHECK(loaded.portals[i].leafnums[1] == prtfile.portals[i].leafnums[1]);
+            REQUIRE(loaded.portals[i].winding.size() == prtfile.portals[i].winding.size());
+
+            for (size_t j = 0; j < prtfile.portals[i].winding.size(); j++) {
+                CHECK(loaded.portals[i].winding[j] == prtfile.portals[i].winding[j]);
+            }
+        }
+
+        REQUIRE(loaded.dleafinfos.size() == prtfile.dleafinfos.size());
+        for (size_t i = 0; i < prtfile.dleafinfos.size(); i++) {
+            CHECK(loaded.dleafinfos[i].cluster == prtfile.dleafinfos[i].cluster);
+        }
+    };
+
+    const fs::path path = fs::temp_directory_path() / "test_binary_prt.prt";
+
+    SUBCASE("file")
+    {
+        WriteBinaryPrtFile(path, prtfile);
+        check_equal(LoadPrtFile(path, &bspver_q1));
+        fs::remove(path);
+    }
+
+    SUBCASE("in memory")
+    {
+        prtfile_t copy{};
+        copy.portalleafs = prtfile.portalleafs;
+        copy.portalleafs_real = prtfile.portalleafs_real;
+        for (auto &p : prtfile.portals) {
+            auto &out = copy.portals.emplace_back();
+            out.winding = p.winding.clone();
+            out.leafnums[0] = p.leafnums[0];
+            out.leafnums[1] = p.leafnums[1];
+        }
+        copy.dleafinfos = prtfile.dleafinfos;
+
+        StorePrtFileInMemory(path, std::move(copy));
+        check_equal(LoadPrtFile(path, &bspver_q1));
+
+        // the handoff is consumed by the load
+        CHECK(!fs::exists(path));
+    }
+}
+
+TEST_CASE("pak archive loads")
+{
+    // a pak with 16 small files, file `i` being `i + 1` bytes of value `i`
+    constexpr uint32_t numfiles = 16;
+    std::vector<uint8_t> contents;
+    std::vector<std::tuple<std::string, uint32_t, uint32_t>> entries;
+
+    for (uint32_t i = 0; i < numfiles; i++) {
+        entries.emplace_back(fmt::format("gfx/file{}.lmp", i), 12 + contents.size(), i + 1);
+        contents.insert(contents.end(), i + 1, static_cast<uint8_t>(i));
+    }
+
+    const fs::path pak_path = fs::temp_directory_path() / "test_pak_archive_loads.pak";
+
+    {
+        std::ofstream f(pak_path, std::ios_base::out | std::ios_base::binary);
+        f << endianness<std::endian::little>;
+        f <= std::array<char, 4>{'P', 'A', 'C', 'K'};
+        f <= static_cast<uint32_t>(12 + contents.size());
+        f <= static_cast<uint32_t>(numfiles * 64);
+        f.write(reinterpret_cast<const char *>(contents.data()), contents.size());
+
+        for (auto &[name, offset, size] : entries) {
+            std::array<char, 56> padded_name{};
+            std::memcpy(padded_name.data(), name.data(), name.size());
+            f <= padded_name;
+            f <= offset;
+            f <= size;
+        }
+    }
+
+    auto archive = fs::addArchive(pak_path);
+    REQUIRE(archive);
+
+    // loads share the archive, and don't touch any shared stream state
+    std::vector<fs::data> loaded(numfiles * 8);
+    tbb::parallel_for(static_cast<size_t>(0), loaded.size(), [&](size_t i) {
+        loaded[i] = archive->load(std::get<0>(entries[i % numfiles]));
+    });
+
+    for (size_t i = 0; i < loaded.size(); i++) {
+        const uint32_t file = i % numfiles;
+        REQUIRE(loaded[i]);
+        CHECK(loaded[i]->size() == file + 1);
+        CHECK(std::all_of(loaded[i]->begin(), loaded[i]->end(), [&](uint8_t b) { return b == file; }));
+    }
+
+    CHECK(!archive->load("gfx/missing.lmp"));
+
+    fs::clear();
+    archive.reset();
+    fs::remove(pak_path);
+}
+
 }
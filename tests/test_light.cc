@@ -2,6 +2,8 @@
 
 #include <light/light.hh>
 #include <light/entities.hh>
+#include <light/surflight.hh>
+#include <light/ltface.hh>
 
 #include <random>
 #include <algorithm> // for std::sort
@@ -976,6 +978,366 @@ TEST_CASE("clamp_texcoord")
     CHECK(127 == clamp_texcoord(-129.0f, 128));
 }
 
+TEST_CASE("MakeSurfaceLightTree")
+{
+    std::vector<surfacelight_t> lights;
+
+    for (int i = 0; i < 5; i++) {
+        surfacelight_t l{};
+        l.pos = {i * 64.0, 0, 0};
+        l.points = {qvec3f(l.pos)};
+        l.surfnormal = {0, 0, 1};
+        l.omnidirectional = false;
+        l.totalintensity = 100;
+        l.intensity = 100;
+        l.color = {1, 0.5, 0.25};
+        l.style = (i == 4) ? 1 : 0;
+        lights.push_back(std::move(l));
+    }
+
+    // the brightest light should represent the whole tree
+    lights[2].totalintensity = 200;
+
+    const surfacelight_tree_t tree = MakeSurfaceLightTree(lights);
+
+    // one tree per style, each with a leaf per light
+    REQUIRE(2 == tree.roots.size());
+    CHECK(2 * 4 - 1 + 1 == tree.nodes.size());
+
+    const surfacelight_tree_node_t &root = tree.nodes[tree.roots[0]];
+    CHECK(2 == root.light);
+    CHECK(qvec3f(500, 250, 125) == root.total_power[0]);
+    CHECK(qvec3f(200, 100, 50) == root.max_power[0]);
+    CHECK(qvec3f(0, 0, 0) == root.total_power[1]);
+    CHECK(aabb3d({0, 0, 0}, {192, 0, 0}) == root.bounds);
+    CHECK(doctest::Approx(1.0f) == root.cone_cos);
+
+    const surfacelight_tree_node_t &style1 = tree.nodes[tree.roots[1]];
+    CHECK(style1.is_leaf());
+    CHECK(4 == style1.light);
+}
+
+TEST_CASE("surface light emitter merging")
+{
+    const vec_t s = light_options.surflightsubdivision.value();
+
+    auto make_emitter = [](int32_t facenum, int32_t texinfo, std::vector<int32_t> vertices,
+                            const qvec3d &mins, const qvec3d &maxs) {
+        surfacelight_emitter_t e{};
+        e.facenum = facenum;
+        e.source = -1;
+        e.texinfo = texinfo;
+        e.vertices = std::move(vertices);
+        e.winding = polylib::winding_t{
+            {mins[0], mins[1], 0}, {maxs[0], mins[1], 0}, {maxs[0], maxs[1], 0}, {mins[0], maxs[1], 0}};
+        e.area = e.winding.area();
+        e.normal = {0, 0, 1};
+        e.midpoint = e.winding.center() + e.normal;
+        e.color = {1, 0.5, 0.25};
+        e.intensity = 2;
+        return e;
+    };
+
+    std::vector<surfacelight_emitter_t> emitters;
+    // two neighbours sharing an edge, both in the same grid cell
+    emitters.push_back(make_emitter(0, 0, {0, 1, 2, 3}, {0, 0, 0}, {s / 2, s / 2, 0}));
+    emitters.push_back(make_emitter(1, 0, {1, 4, 5, 2}, {s / 2, 0, 0}, {s, s / 2, 0}));
+    // touches the first one, but has a different texinfo; diced into 4 points
+    emitters.push_back(make_emitter(2, 1, {3, 6, 7, 8}, {0, s / 2, 0}, {s * 4, s, 0}));
+
+    const auto groups = GroupSurfaceLightEmitters(emitters);
+
+    REQUIRE(2 == groups.size());
+    CHECK(std::vector<int32_t>{0, 1} == groups[0]);
+    CHECK(std::vector<int32_t>{2} == groups[1]);
+
+    SUBCASE("merged")
+    {
+        const surfacelight_t l = MakeSurfaceLight(light_options, emitters, groups[0]);
+
+        // the pieces share a cell, so they become one point at their area weighted center
+        REQUIRE(1 == l.points.size());
+        CHECK(qv::epsilonEqual(qvec3f(s / 2, s / 4, 1), l.points[0], 0.001f));
+        CHECK(qv::epsilonEqual(qvec3d(s / 2, s / 4, 1), l.pos, 0.001));
+        CHECK(doctest::Approx(2 * (emitters[0].area + emitters[1].area)) == l.totalintensity);
+        CHECK(doctest::Approx(l.totalintensity) == l.intensity);
+        CHECK(qvec3d(qvec3f(1, 0.5, 0.25)) == l.color);
+    }
+
+    SUBCASE("lone face matches the plain dice")
+    {
+        const surfacelight_t l = MakeSurfaceLight(light_options, emitters, groups[1]);
+        const surfacelight_emitter_t &e = emitters[2];
+
+        std::vector<qvec3f> expected;
+        polylib::winding_t w = e.winding.clone();
+        w.dice(s, [&](polylib::winding_t &piece) { expected.push_back(piece.center() + e.normal); });
+
+        CHECK(4 == expected.size());
+        CHECK(expected == l.points);
+        CHECK(e.midpoint == l.pos);
+        CHECK(e.intensity * e.area == l.totalintensity);
+        CHECK(l.totalintensity / expected.size() == l.intensity);
+    }
+}
+
+// the direct 2D loops the lightmap post-filters used to be written as
+static std::vector<qvec4f> ReferenceBoxBlur(const std::vector<qvec4f> &input, int w, int h, int radius)
+{
+    std::vector<qvec4f> res(input.size());
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float totalWeight = 0.0f, totalWeightIgnoringOcclusion = 0.0f;
+            qvec3f totalColor{}, totalColorIgnoringOcclusion{};
+
+            for (int y0 = -radius; y0 <= radius; y0++) {
+                for (int x0 = -radius; x0 <= radius; x0++) {
+                    const qvec4f &inSample = input[(clamp(y + y0, 0, h - 1) * w) + clamp(x + x0, 0, w - 1)];
+
+                    totalColorIgnoringOcclusion += qvec3f(inSample);
+                    totalWeightIgnoringOcclusion += 1.0f;
+
+                    if (inSample[3] == 0.0f)
+                        continue;
+
+                    totalColor += qvec3f(inSample);
+                    totalWeight += 1.0f;
+                }
+            }
+
+            if (totalWeight > 0.0f) {
+                const qvec3f tmp = totalColor / totalWeight;
+                res[(y * w) + x] = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
+            } else {
+                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
+                res[(y * w) + x] = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
+            }
+        }
+    }
+
+    return res;
+}
+
+static std::vector<qvec4f> ReferenceDownsample(const std::vector<qvec4f> &input, int w, int h, int factor)
+{
+    const int outw = w / factor, outh = h / factor;
+    std::vector<qvec4f> res(outw * outh);
+
+    for (int y = 0; y < outh; y++) {
+        for (int x = 0; x < outw; x++) {
+            float totalWeight = 0.0f, totalWeightIgnoringOcclusion = 0.0f;
+            qvec3f totalColor{}, totalColorIgnoringOcclusion{};
+
+            for (int y0 = 0; y0 < factor; y0++) {
+                for (int x0 = 0; x0 < factor; x0++) {
+                    const qvec4f &inSample = input[(((y * factor) + y0) * w) + (x * factor) + x0];
+
+                    totalColorIgnoringOcclusion += qvec3f(inSample);
+                    totalWeightIgnoringOcclusion += 1.0f;
+
+                    if (inSample[3] == 0.0f)
+                        continue;
+
+                    totalColor += qvec3f(inSample);
+                    totalWeight += 1.0f;
+                }
+            }
+
+            if (totalWeight > 0.0f) {
+                const qvec3f tmp = totalColor / totalWeight;
+                res[(y * outw) + x] = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
+            } else {
+                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
+                res[(y * outw) + x] = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
+            }
+        }
+    }
+
+    return res;
+}
+
+static std::vector<qvec4f> ReferenceFloodFill(std::vector<qvec4f> res, int w, int h)
+{
+    while (1) {
+        size_t unhandled_pixels = 0;
+
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                if (res[(y * w) + x][3] != 0)
+                    continue;
+
+                int opaque_neighbours = 0;
+                qvec3f neighbours_sum{};
+                for (int y1 = y - 1; y1 <= y + 1; y1++) {
+                    for (int x1 = x - 1; x1 <= x + 1; x1++) {
+                        if (x1 < 0 || x1 >= w || y1 < 0 || y1 >= h)
+                            continue;
+                        if (res[(y1 * w) + x1][3] == 1) {
+                            opaque_neighbours++;
+                            neighbours_sum += qvec3f(res[(y1 * w) + x1]);
+                        }
+                    }
+                }
+
+                if (opaque_neighbours > 0) {
+                    neighbours_sum *= (1.0f / (float)opaque_neighbours);
+                    res[(y * w) + x] = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
+                } else {
+                    unhandled_pixels++;
+                }
+            }
+        }
+
+        if (unhandled_pixels == res.size() || unhandled_pixels == 0)
+            break;
+    }
+
+    return res;
+}
+
+static std::vector<qvec4f> RandomLightmap(int w, int h, float occluded_fraction, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> color(0.0f, 300.0f), chance(0.0f, 1.0f);
+    std::vector<qvec4f> image(w * h);
+
+    for (auto &sample : image) {
+        sample = {color(rng), color(rng), color(rng), chance(rng) < occluded_fraction ? 0.0f : 1.0f};
+    }
+
+    return image;
+}
+
+static void CheckImagesEqual(const std::vector<qvec4f> &a, const std::vector<qvec4f> &b, float epsilon)
+{
+    REQUIRE(a.size() == b.size());
+
+    for (size_t i = 0; i < a.size(); i++) {
+        CHECK(a[i][3] == b[i][3]);
+        for (int j = 0; j < 3; j++) {
+            if (epsilon) {
+                CHECK(a[i][j] == doctest::Approx(b[i][j]).epsilon(epsilon));
+            } else {
+                CHECK(a[i][j] == b[i][j]);
+            }
+        }
+    }
+}
+
+TEST_CASE("lightmap post-filters")
+{
+    std::mt19937 rng(42);
+
+    for (const auto &[w, h] : {std::pair{1, 1}, std::pair{4, 4}, std::pair{17, 9}, std::pair{64, 48}}) {
+        for (const float occluded : {0.0f, 0.3f, 1.0f}) {
+            CAPTURE(w);
+            CAPTURE(h);
+            CAPTURE(occluded);
+
+            const std::vector<qvec4f> image = RandomLightmap(w, h, occluded, rng);
+
+            // the flood fill and downsample add in the same order, so they are exact
+            std::vector<qvec4f> filled = image;
+            FloodFillTransparent(filled, w, h);
+            CheckImagesEqual(filled, ReferenceFloodFill(image, w, h), 0.0f);
+
+            for (const int factor : {1, 2, 4}) {
+                if (w % factor || h % factor)
+                    continue;
+
+                std::vector<qvec4f> downsampled;
+                IntegerDownsampleImage(image, downsampled, w, h, factor);
+                CheckImagesEqual(downsampled, ReferenceDownsample(image, w, h, factor), 0.0f);
+            }
+
+            // the running-sum blur sums in a different order
+            for (const int radius : {1, 2, 5}) {
+                std::vector<qvec4f> blurred;
+                BoxBlurImage(image, blurred, w, h, radius);
+                CheckImagesEqual(blurred, ReferenceBoxBlur(image, w, h, radius), 1e-5f);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("adaptive dirt")
+{
+    const int w = 16, h = 8, num_vectors = 48;
+    const vec_t depth = 128, threshold = 0.05;
+
+    std::vector<bool> occluded(w * h, false);
+    occluded[3 * w + 12] = true;
+
+    // a smooth gradient along s, with a sharp edge at s = 6 for every third vector
+    auto hitdist = [&](int i, int j) -> vec_t {
+        const int s = i % w;
+        if (s < 6 && !(j % 3))
+            return 4;
+        return 24 + 3 * s + (j * 7) % 11;
+    };
+
+    auto run = [&](vec_t run_threshold, std::vector<uint8_t> &refine) {
+        std::vector<float> occlusion(w * h, 0.0f);
+        CalculateDirtOcclusion(occlusion, refine, occluded, w, h, num_vectors, depth, run_threshold,
+            [&](int j, const std::vector<uint8_t> *only) {
+                for (int i = 0; i < w * h; i++) {
+                    if (occluded[i] || (only && !(*only)[i]))
+                        continue;
+                    occlusion[i] += hitdist(i, j);
+                }
+            });
+        return occlusion;
+    };
+
+    // the occlusion from the coarse subset, summed the same way
+    auto coarse = [&](int i) {
+        float sum = 0;
+        int n = 0;
+        for (int j = 0; j < num_vectors; j += DIRT_ADAPTIVE_STRIDE, n++)
+            sum += hitdist(i, j);
+        return 1 - ((sum / (float)n) / depth);
+    };
+
+    std::vector<uint8_t> full_refine, refine;
+    const std::vector<float> full = run(0, full_refine);
+    const std::vector<float> adaptive = run(threshold, refine);
+
+    int num_refined = 0, num_coarse = 0;
+
+    for (int t = 0; t < h; t++) {
+        for (int s = 0; s < w; s++) {
+            const int i = t * w + s;
+            CAPTURE(s);
+            CAPTURE(t);
+
+            if (occluded[i])
+                continue;
+
+            if (refine[i]) {
+                // traced with every vector, in the same order
+                ++num_refined;
+                CHECK(adaptive[i] == full[i]);
+                continue;
+            }
+
+            // not refined: the coarse result is kept, and it's within the
+            // threshold of every neighbour's
+            ++num_coarse;
+            CHECK(adaptive[i] == coarse(i));
+
+            for (const auto &[ns, nt] : {std::pair{s - 1, t}, std::pair{s + 1, t}, std::pair{s, t - 1}, std::pair{s, t + 1}}) {
+                if (ns < 0 || ns >= w || nt < 0 || nt >= h || occluded[nt * w + ns])
+                    continue;
+
+                CHECK(fabs(coarse(i) - coarse(nt * w + ns)) <= threshold);
+            }
+        }
+    }
+
+    CHECK(num_refined > 0);
+    CHECK(num_coarse > 0);
+}
 }
 
 TEST_SUITE("settings") {
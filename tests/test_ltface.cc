@@ -1,6 +1,7 @@
 #include <doctest/doctest.h>
 
 #include <light/light.hh>
+#include <light/surflight.hh>
 #include <common/bspinfo.hh>
 #include <qbsp/qbsp.hh>
 #include <testmaps.hh>
@@ -263,6 +264,33 @@ TEST_CASE("emissive lights") {
     }
 }
 
+TEST_CASE("surface lights by face") {
+    auto [bsp, bspx] = QbspVisLight_Q2("light_q2_emissive_cube.map", {});
+
+    const auto &lights = GetSurfaceLights();
+    REQUIRE(!lights.empty());
+
+    size_t emissive_faces = 0;
+
+    for (auto &face : bsp.dfaces) {
+        const auto face_lights = SurfaceLightsForFaceNum(Face_GetNum(&bsp, &face));
+
+        if (!IsSurfaceLitFace(&bsp, &face)) {
+            CHECK(face_lights.empty());
+            continue;
+        }
+
+        emissive_faces++;
+
+        // each emissive face is part of one light, facing the same way
+        REQUIRE(1 == face_lights.size());
+        CHECK(qv::epsilonEqual(qvec3f(Face_Normal(&bsp, &face)), lights[face_lights[0]].surfnormal, 0.001f));
+    }
+
+    // coplanar neighbours can share a light, but every light has at least one face
+    CHECK(lights.size() <= emissive_faces);
+}
+
 TEST_CASE("q2_phong_doesnt_cross_contents") {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_phong_doesnt_cross_contents.map", {"-wrnormals"});
 }
@@ -293,6 +321,21 @@ TEST_CASE("q2_dirt") {
     });
 }
 
+TEST_CASE("q2_dirt -dirtadaptive") {
+    INFO("liquids don't cast dirt, with adaptive dirt too");
+
+    // which samples get refined, and what they get, is checked in test_light.cc ("adaptive dirt")
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_dirt.map", {"-dirtadaptive", "0.05"});
+
+    auto *face_under_lava = BSP_FindFaceAtPoint(&bsp, &bsp.dmodels[0], {104, 112, 48});
+    REQUIRE(face_under_lava);
+
+    // every dirt vector misses here, so the coarse subset does too
+    CheckFaceLuxels(bsp, *face_under_lava, [](qvec3b sample){
+        CHECK(sample == qvec3b(96));
+    });
+}
+
 TEST_CASE("q2_light_translucency") {
     INFO("liquids cast translucent colored shadows (sampling texture) by default");
 
@@ -349,6 +392,24 @@ TEST_CASE("q2_light_translucency") {
     }
 }
 
+TEST_CASE("qbsp -memoryprt hands the portals to vis") {
+    const std::filesystem::path map = "q2_light_visapprox.map";
+
+    // the binary .prt keeps full precision too, so vis should come out the same
+    auto [binary_bsp, binary_bspx] = QbspVisLight_Common(map, {"-q2bsp", "-binaryprt"}, {}, runvis_t::yes);
+
+    fs::path prt_path = fs::path(test_quake2_maps_dir) / map;
+    prt_path.replace_extension(".prt");
+    fs::remove(prt_path);
+
+    auto [memory_bsp, memory_bspx] = QbspVisLight_Common(map, {"-q2bsp", "-memoryprt"}, {}, runvis_t::yes);
+
+    CHECK(!fs::exists(prt_path));
+    REQUIRE(!memory_bsp.dvis.bits.empty());
+    CHECK(memory_bsp.dvis.bits == binary_bsp.dvis.bits);
+    CHECK(memory_bsp.dvis.bit_offsets == binary_bsp.dvis.bit_offsets);
+}
+
 TEST_CASE("-visapprox vis with opaque liquids") {
     INFO("opaque liquids block vis, but don't cast shadows by default.");
     INFO("make sure '-visapprox vis' doesn't wrongly cull rays that should illuminate the level.");
@@ -531,3 +592,24 @@ TEST_CASE("q2_light_cone") {
     CheckSpotCutoff(bsp, {1092, 1472, 952});
     CheckSpotCutoff(bsp, {1236, 1472, 952});
 }
+
+TEST_CASE("-deterministic output doesn't depend on the thread count")
+{
+    // surface lights + bounce, so the light lists built in parallel are used too
+    auto run = [](const char *threads) {
+        return QbspVisLight_Q2("light_q2_emissive_cube.map", {"-threads", threads, "-bounce", "-deterministic"});
+    };
+
+    auto [bsp1, bspx1] = run("1");
+    auto [bsp4, bspx4] = run("4");
+
+    REQUIRE(bsp1.dfaces.size() == bsp4.dfaces.size());
+
+    for (size_t i = 0; i < bsp1.dfaces.size(); i++) {
+        INFO("face ", i);
+        CHECK(bsp1.dfaces[i].lightofs == bsp4.dfaces[i].lightofs);
+        CHECK(bsp1.dfaces[i].styles == bsp4.dfaces[i].styles);
+    }
+
+    CHECK(bsp1.dlightdata == bsp4.dlightdata);
+}
@@ -323,6 +323,46 @@ TEST_CASE("duplicatePlanes" * doctest::test_suite("qbsp"))
     CHECK(6 == brush->sides.size());
 }
 
+TEST_CASE("parseBrushBlocks" * doctest::test_suite("qbsp"))
+{
+    // brushes are skipped over before being parsed, so make sure
+    // texture names starting with { and comments don't throw that off
+    const char *map = R"(
+    {
+        "classname" "worldspawn"
+        // a comment with a stray }
+        {
+            ( -64 -64 -16 ) ( -64 -63 -16 ) ( -64 -64 -15 ) {fence 0 0 0 1 1
+            ( 64 64 16 ) ( 64 64 17 ) ( 64 65 16 ) {fence 0 0 0 1 1
+            ( -64 -64 -16 ) ( -64 -64 -15 ) ( -63 -64 -16 ) {fence 0 0 0 1 1
+            ( 64 64 16 ) ( 65 64 16 ) ( 64 64 17 ) {fence 0 0 0 1 1 ; quark-style comment }
+            ( -64 -64 -16 ) ( -63 -64 -16 ) ( -64 -63 -16 ) {fence 0 0 0 1 1
+            ( 64 64 16 ) ( 64 65 16 ) ( 65 64 16 ) {fence +0 0 0 1 1
+        }
+        {
+            ( 128 -64 -16 ) ( 128 -63 -16 ) ( 128 -64 -15 ) skip 0 0 0 1 1
+            ( 256 64 16 ) ( 256 64 17 ) ( 256 65 16 ) skip 0 0 0 1 1
+            ( 128 -64 -16 ) ( 128 -64 -15 ) ( 129 -64 -16 ) skip 0 0 0 1 1
+            ( 256 64 16 ) ( 257 64 16 ) ( 256 64 17 ) skip 0 0 0 1 1
+            ( 128 -64 -16 ) ( 129 -64 -16 ) ( 128 -63 -16 ) skip 0 0 0 1 1
+            ( 256 64 16 ) ( 256 65 16 ) ( 257 64 16 ) skip 0 0 0 1 1
+        }
+    }
+    )";
+
+    mapentity_t &worldspawn = LoadMap(map);
+    REQUIRE(2 == worldspawn.mapbrushes.size());
+
+    CHECK(6 == worldspawn.mapbrushes[0].faces.size());
+    CHECK(6 == worldspawn.mapbrushes[1].faces.size());
+    CHECK("{fence" == worldspawn.mapbrushes[0].faces[0].texname);
+    CHECK("skip" == worldspawn.mapbrushes[1].faces[0].texname);
+
+    // line numbers carry over into each brush
+    CHECK(6 == worldspawn.mapbrushes[0].line.line_number.value());
+    CHECK(14 == worldspawn.mapbrushes[1].line.line_number.value());
+}
+
 /**
  * Test that this skip face gets auto-corrected.
  */
@@ -943,6 +983,42 @@ TEST_CASE("tjunc_many_sided_face" * doctest::test_suite("testmaps_q1"))
     CHECK(2 == (faces_by_normal.at({0, 0, -1}).size()));
 }
 
+TEST_CASE("tjunc_ear_clip" * doctest::test_suite("testmaps_q1"))
+{
+    INFO("floor and ceiling have too many T-junction vertices for MWT, so they're ear clipped");
+
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_tjunc_ear_clip.map", {"-tjunc", "mwt"});
+
+    REQUIRE(prt.has_value());
+
+    for (const qvec3d &normal : {qvec3d(0, 0, 1), qvec3d(0, 0, -1)}) {
+        INFO("normal ", normal);
+
+        vec_t area = 0;
+
+        for (auto &face : bsp.dfaces) {
+            if (Face_Normal(&bsp, &face) != normal) {
+                continue;
+            }
+
+            // faces are drawn as fans from their first vertex; none of those may be zero-area
+            const qvec3d p0 = Face_PointAtIndex(&bsp, &face, 0);
+
+            for (int i = 2; i < face.numedges; i++) {
+                const qvec3d p1 = Face_PointAtIndex(&bsp, &face, i - 1);
+                const qvec3d p2 = Face_PointAtIndex(&bsp, &face, i);
+
+                CHECK(qv::length(qv::cross(p1 - p0, p2 - p0)) > 1.0);
+            }
+
+            area += Face_Winding(&bsp, &face).area();
+        }
+
+        // the fragments still cover the whole room
+        CHECK(area == doctest::Approx(1152.0 * 1152.0));
+    }
+}
+
 TEST_CASE("tjunc_angled_face" * doctest::test_suite("testmaps_q1"))
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_tjunc_angled_face.map");
@@ -1286,6 +1362,36 @@ TEST_CASE("qbsp_q1_sealing" * doctest::test_suite("testmaps_q1")) {
     CHECK(prt->portalleafs_real == 3); // no detail, so same as above
 }
 
+TEST_CASE("qbsp_q1_sealing sahsplit" * doctest::test_suite("testmaps_q1")) {
+    // a small maxnodesize makes the world hull use the SAH for most nodes
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_q1_sealing.map", {"-sahsplit", "-maxnodesize", "64"});
+
+    const qvec3d in_start_room {-192, 144, 104};
+    const qvec3d in_emptyroom {-168, 544, 104};
+    const qvec3d in_void {-16, -800, 56};
+    const qvec3d connected_by_thin_gap {72, 136, 104};
+
+    // the tree shape is different, but the contents must match the default heuristics
+    CHECK(CONTENTS_EMPTY == BSP_FindLeafAtPoint(&bsp, &bsp.dmodels[0], in_start_room)->contents);
+    CHECK(CONTENTS_SOLID == BSP_FindLeafAtPoint(&bsp, &bsp.dmodels[0], in_emptyroom)->contents);
+    CHECK(CONTENTS_SOLID == BSP_FindLeafAtPoint(&bsp, &bsp.dmodels[0], in_void)->contents);
+    CHECK(CONTENTS_EMPTY == BSP_FindLeafAtPoint(&bsp, &bsp.dmodels[0], connected_by_thin_gap)->contents);
+
+    CHECK(CONTENTS_EMPTY == BSP_FindContentsAtPoint(&bsp, 1, &bsp.dmodels[0], in_start_room));
+    CHECK(CONTENTS_SOLID == BSP_FindContentsAtPoint(&bsp, 1, &bsp.dmodels[0], in_void));
+    CHECK(CONTENTS_EMPTY == BSP_FindContentsAtPoint(&bsp, 2, &bsp.dmodels[0], in_start_room));
+    CHECK(CONTENTS_SOLID == BSP_FindContentsAtPoint(&bsp, 2, &bsp.dmodels[0], in_void));
+
+    // and -sahsplit actually took effect: the same map with the default heuristics splits differently
+    const auto [default_bsp, default_bspx, default_prt] = LoadTestmapQ1("qbsp_q1_sealing.map", {"-maxnodesize", "64"});
+
+    bool same_tree = bsp.dnodes.size() == default_bsp.dnodes.size();
+    for (size_t i = 0; same_tree && i < bsp.dnodes.size(); i++) {
+        same_tree = bsp.dnodes[i].planenum == default_bsp.dnodes[i].planenum;
+    }
+    CHECK_FALSE(same_tree);
+}
+
 TEST_CASE("q1_csg" * doctest::test_suite("testmaps_q1")) {
     auto &entity = LoadMapPath("qbsp_q1_csg.map");
 
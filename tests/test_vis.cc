@@ -0,0 +1,149 @@
+#include <doctest/doctest.h>
+
+#include <vis/vis.hh>
+
+#include <fstream>
+
+TEST_SUITE("vis") {
+
+static mleaf_t MakeLeaf(const qvec3f &mins, const qvec3f &maxs)
+{
+    mleaf_t leaf{};
+    leaf.mins = mins;
+    leaf.maxs = maxs;
+    return leaf;
+}
+
+static prtfile_portal_t MakePortal(float x, int front, int back)
+{
+    prtfile_portal_t portal;
+    portal.winding = prtfile_winding_t{{x, 0, 0}, {x, 64, 0}, {x, 64, 64}, {x, 0, 64}};
+    portal.leafnums[0] = front;
+    portal.leafnums[1] = back;
+    return portal;
+}
+
+TEST_CASE("MergeSmallClusters")
+{
+    // three leafs in a row along X; the middle one is a 1 unit sliver
+    std::vector<mleaf_t> dleafs{
+        {}, // solid leaf
+        MakeLeaf({0, 0, 0}, {64, 64, 64}),
+        MakeLeaf({64, 0, 0}, {65, 64, 64}),
+        MakeLeaf({65, 0, 0}, {129, 64, 64}),
+    };
+
+    prtfile_t prtfile{};
+    prtfile.portalleafs = prtfile.portalleafs_real = 3;
+    prtfile.portals.push_back(MakePortal(64, 0, 1));
+    prtfile.portals.push_back(MakePortal(65, 1, 2));
+    prtfile.dleafinfos.resize(4);
+    for (int i = 0; i < 3; i++) {
+        prtfile.dleafinfos[i + 1].cluster = i;
+    }
+
+    SUBCASE("below the threshold")
+    {
+        CHECK(1 == MergeSmallClusters(prtfile, dleafs, 64 * 64 * 2, MAX_PORTALS_ON_LEAF));
+
+        // the sliver goes into the first neighbour (equal portal area), taking its portal with it
+        CHECK(2 == prtfile.portalleafs);
+        CHECK(3 == prtfile.portalleafs_real);
+        REQUIRE(1 == prtfile.portals.size());
+        CHECK(0 == prtfile.portals[0].leafnums[0]);
+        CHECK(1 == prtfile.portals[0].leafnums[1]);
+        CHECK(0 == prtfile.dleafinfos[1].cluster);
+        CHECK(0 == prtfile.dleafinfos[2].cluster);
+        CHECK(1 == prtfile.dleafinfos[3].cluster);
+    }
+
+    SUBCASE("above the threshold")
+    {
+        CHECK(0 == MergeSmallClusters(prtfile, dleafs, 64, MAX_PORTALS_ON_LEAF));
+        CHECK(3 == prtfile.portalleafs);
+        CHECK(2 == prtfile.portals.size());
+    }
+
+    SUBCASE("portal limit")
+    {
+        // merging into either neighbour leaves it with 1 portal
+        CHECK(0 == MergeSmallClusters(prtfile, dleafs, 64 * 64 * 2, 0));
+        CHECK(1 == MergeSmallClusters(prtfile, dleafs, 64 * 64 * 2, 1));
+    }
+}
+
+TEST_CASE("vis state round trip")
+{
+    const fs::path dir = fs::temp_directory_path();
+    portalfile = dir / "test_vis_state.prt";
+    statefile = dir / "test_vis_state.vis";
+    statetmpfile = dir / "test_vis_state.vi0";
+
+    {
+        std::ofstream f(portalfile);
+        f << "PRT1\n";
+    }
+    fs::last_write_time(portalfile, fs::last_write_time(portalfile) - std::chrono::hours(1));
+
+    // 4 words: zero, all ones, and partial words the codec stores literally
+    portalleafs = 100;
+    numportals = 1;
+    portals.resize(2);
+
+    for (auto &p : portals) {
+        p.mightsee.resize(portalleafs);
+        p.visbits.resize(portalleafs);
+    }
+
+    portals[0].status = pstat_done;
+    portals[0].mightsee.data()[1] = 0xffffffff;
+    portals[0].mightsee.data()[2] = 0x12345678;
+    portals[0].mightsee.data()[3] = 0xf;
+    portals[0].visbits.data()[2] = 0x00ff00ff;
+    portals[0].nummightsee = 69;
+    portals[0].numcansee = 16;
+
+    portals[1].status = pstat_working;
+    portals[1].mightsee.data()[0] = 0xffffffff;
+    portals[1].mightsee.data()[1] = 0xffffffff;
+    portals[1].nummightsee = 64;
+    portals[1].numcansee = 0;
+
+    std::vector<visportal_t> expected(2);
+    for (size_t i = 0; i < 2; i++) {
+        expected[i].status = portals[i].status;
+        expected[i].mightsee = portals[i].mightsee;
+        expected[i].visbits = portals[i].visbits;
+        expected[i].nummightsee = portals[i].nummightsee;
+        expected[i].numcansee = portals[i].numcansee;
+    }
+
+    starttime = statetime = I_FloatTime();
+    SaveVisState();
+    WaitVisState();
+
+    CHECK(fs::exists(statefile));
+    CHECK(!fs::exists(statetmpfile));
+
+    portals = std::vector<visportal_t>(2);
+    REQUIRE(LoadVisState());
+
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t j = 0; j < portalleafs; j++) {
+            CHECK(bool(portals[i].mightsee[j]) == bool(expected[i].mightsee[j]));
+            CHECK(bool(portals[i].visbits[j]) == bool(expected[i].visbits[j]));
+        }
+        CHECK(portals[i].nummightsee == expected[i].nummightsee);
+        CHECK(portals[i].numcansee == expected[i].numcansee);
+    }
+
+    CHECK(portals[0].status == pstat_done);
+    // in-progress portals are restarted
+    CHECK(portals[1].status == pstat_none);
+
+    portals.clear();
+    fs::remove(statefile);
+    fs::remove(portalfile);
+}
+
+}
@@ -2,7 +2,15 @@
 #include <vis/leafbits.hh>
 #include <common/log.hh>
 #include <common/parallel.hh>
+#include <tbb/enumerable_thread_specific.h>
+#include <algorithm>
 #include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 unsigned long c_chains;
 int c_vistest, c_mighttest;
@@ -12,14 +20,11 @@ static int c_leafskip;
 
 /*
   ==============
-  ClipToSeparators
-
-  Source, pass, and target are an ordering of portals.
+  ForEachSeparator
 
-  Generates separating planes canidates by taking two points from source and
-  one point from pass, and clips target by them.
-
-  If target is totally clipped away, that portal can not be seen through.
+  Generates the separating plane candidates for ClipToSeparators by taking
+  two points from source and one point from pass, and calls fn with each
+  valid separator until it returns false.
 
   Normal clip keeps target on the same side as pass, which is correct
   if the order goes source, pass, target. If the order goes pass,
@@ -30,8 +35,9 @@ static int c_leafskip;
   pointer, was measurably faster
   ==============
 */
-static void ClipToSeparators(const viswinding_t *source, const qplane3d src_pl, const viswinding_t *pass, viswinding_t *&target,
-    unsigned int test, pstack_t &stack)
+template<typename F>
+static void ForEachSeparator(
+    const viswinding_t *source, const qplane3d src_pl, const viswinding_t *pass, unsigned int test, F &&fn)
 {
     int i, j, k, l;
     qplane3d sep;
@@ -106,22 +112,247 @@ static void ClipToSeparators(const viswinding_t *source, const qplane3d src_pl,
                 sep = -sep;
             }
 
-            /* Cache separating planes for tests 0, 1 */
-            if (test < 2) {
-                if (stack.numseparators[test] == MAX_SEPARATORS)
-                    FError("MAX_SEPARATORS");
-                stack.separators[test][stack.numseparators[test]] = sep;
-                stack.numseparators[test]++;
+            if (!fn(sep))
+                return;
+
+            break;
+        }
+    }
+}
+
+/*
+  ==================
+  separator_cache_t
+
+  Separating planes for tests 0 and 1 between two unclipped portal windings.
+  The source is only unclipped while it's still the base portal's own
+  winding, so every key includes the base portal and entries are only
+  re-used within that portal's PortalFlow; off by default (-separatorcache)
+  since stack.separators already covers the re-use within one frame.
+  Bounded to a number of entries, evicting the least recently used; the
+  cache is split into shards, each with its own lock and LRU list.
+  ==================
+*/
+class separator_cache_t
+{
+    struct entry_t
+    {
+        uint64_t key;
+        std::vector<qplane3d> planes;
+    };
+
+    struct shard_t
+    {
+        std::mutex lock;
+        // most recently used first
+        std::list<entry_t> lru;
+        std::unordered_map<uint64_t, std::list<entry_t>::iterator> index;
+    };
+
+    static constexpr size_t NUM_SHARDS = 64;
+    std::array<shard_t, NUM_SHARDS> shards;
+    size_t shard_capacity = 0;
+
+    inline shard_t &shard_for(uint64_t key) { return shards[(key * 0x9E3779B97F4A7C15ull) >> 58]; }
+
+    struct counters_t
+    {
+        uint64_t hits = 0, misses = 0;
+    };
+
+    // per thread, so the lookups don't share a cache line
+    tbb::enumerable_thread_specific<counters_t> counters;
+
+public:
+
+    inline bool enabled() const { return shard_capacity != 0; }
+
+    // drops all entries; a capacity of 0 disables the cache
+    void reset(size_t capacity)
+    {
+        shard_capacity = capacity ? std::max(capacity / NUM_SHARDS, size_t(1)) : 0;
+        counters.clear();
+
+        for (auto &shard : shards) {
+            shard.lru.clear();
+            shard.index.clear();
+        }
+    }
+
+    // copies the planes for `key` into `out` and returns how many there are
+    std::optional<size_t> find(uint64_t key, qplane3d *out)
+    {
+        shard_t &shard = shard_for(key);
+        std::unique_lock lock(shard.lock);
+
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            lock.unlock();
+            counters.local().misses++;
+            return std::nullopt;
+        }
+
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        const std::vector<qplane3d> &planes = it->second->planes;
+        std::copy(planes.begin(), planes.end(), out);
+        const size_t count = planes.size();
+
+        lock.unlock();
+        counters.local().hits++;
+        return count;
+    }
+
+    counters_t totals() const
+    {
+        counters_t result;
+
+        for (const counters_t &c : counters) {
+            result.hits += c.hits;
+            result.misses += c.misses;
+        }
+
+        return result;
+    }
+
+    void insert(uint64_t key, const qplane3d *planes, size_t count)
+    {
+        shard_t &shard = shard_for(key);
+        std::unique_lock lock(shard.lock);
+
+        if (shard.index.count(key)) {
+            return; // another thread got here first
+        }
+
+        if (shard.lru.size() >= shard_capacity) {
+            // recycle the least recently used entry, and its storage
+            shard.lru.splice(shard.lru.begin(), shard.lru, std::prev(shard.lru.end()));
+            shard.index.erase(shard.lru.front().key);
+        } else {
+            shard.lru.emplace_front();
+        }
+
+        entry_t &entry = shard.lru.front();
+        entry.key = key;
+        entry.planes.assign(planes, planes + count);
+        shard.index.emplace(key, shard.lru.begin());
+    }
+};
+
+static separator_cache_t separator_cache;
+
+void ResetSeparatorCache()
+{
+    separator_cache.reset(vis_options.separatorcache.value());
+}
+
+void PrintSeparatorCacheStats()
+{
+    if (!separator_cache.enabled()) {
+        return;
+    }
+
+    const auto [hits, misses] = separator_cache.totals();
+    logging::print("separator cache: {} hits, {} misses ({:.1f}% hit rate)\n", hits, misses,
+        (hits + misses) ? (100.0 * hits) / (hits + misses) : 0.0);
+}
+
+// returns the index of the portal `w` is the (unclipped) winding of, or -1
+static ptrdiff_t UnclippedPortalNum(const viswinding_t *w)
+{
+    if (portals.empty()) {
+        return -1;
+    }
+
+    const uintptr_t offset = reinterpret_cast<uintptr_t>(w) - reinterpret_cast<uintptr_t>(&portals[0].winding);
+    const size_t num = offset / sizeof(visportal_t);
+
+    if (num >= portals.size() || &portals[num].winding != w) {
+        return -1;
+    }
+
+    return num;
+}
+
+/*
+  ==============
+  ClipToSeparators
+
+  Source, pass, and target are an ordering of portals.
+
+  Clips target by the separating planes between source and pass (see
+  ForEachSeparator).
+
+  If target is totally clipped away, that portal can not be seen through.
+
+  Tests 0 and 1 record the separators they clipped with in the stack's
+  cache; when source and pass are both unclipped portal windings, the
+  separators also come from / go to the shared separator_cache_t.
+  ==============
+*/
+static void ClipToSeparators(const viswinding_t *source, const qplane3d src_pl, const viswinding_t *pass, viswinding_t *&target,
+    unsigned int test, pstack_t &stack)
+{
+    if (test < 2 && separator_cache.enabled()) {
+        const ptrdiff_t source_num = UnclippedPortalNum(source);
+        const ptrdiff_t pass_num = source_num != -1 ? UnclippedPortalNum(pass) : -1;
+
+        if (pass_num != -1) {
+            const uint64_t key = ((uint64_t(source_num) * portals.size() + pass_num) << 1) | test;
+            qplane3d *separators = stack.separators[test];
+            size_t count;
+
+            bool overflow = false;
+
+            if (auto cached = separator_cache.find(key, separators)) {
+                count = *cached;
+            } else {
+                count = 0;
+                ForEachSeparator(source, src_pl, pass, test, [&](const qplane3d &sep) {
+                    if (count == MAX_SEPARATORS) {
+                        overflow = true;
+                        return false;
+                    }
+                    separators[count++] = sep;
+                    return true;
+                });
+
+                // the full list doesn't fit; don't cache it, the lazy path
+                // below only errors if it actually needs that many
+                if (!overflow) {
+                    separator_cache.insert(key, separators, count);
+                }
             }
 
-            target = ClipStackWinding(target, stack, sep);
+            if (!overflow) {
+                // the stack keeps the separators up to the one that clipped
+                // target away, same as the uncached path below
+                for (size_t i = 0; i < count; i++) {
+                    stack.numseparators[test] = i + 1;
+                    target = ClipStackWinding(target, stack, separators[i]);
 
-            if (!target)
-                return; // target is not visible
+                    if (!target)
+                        return; // target is not visible
+                }
 
-            break;
+                return;
+            }
         }
     }
+
+    ForEachSeparator(source, src_pl, pass, test, [&](const qplane3d &sep) {
+        /* Cache separating planes for tests 0, 1 */
+        if (test < 2) {
+            if (stack.numseparators[test] == MAX_SEPARATORS)
+                FError("MAX_SEPARATORS");
+            stack.separators[test][stack.numseparators[test]] = sep;
+            stack.numseparators[test]++;
+        }
+
+        target = ClipStackWinding(target, stack, sep);
+
+        // stop once target is not visible
+        return target != nullptr;
+    });
 }
 
 static int CheckStack(leaf_t *leaf, threaddata_t *thread)
@@ -134,6 +365,54 @@ static int CheckStack(leaf_t *leaf, threaddata_t *thread)
     return 0;
 }
 
+/*
+  ==================
+  flow_arena_t
+
+  Per-thread pstack_t frames and mightsee bitsets for RecursiveLeafFlow,
+  indexed by recursion depth. It grows to the deepest chain the thread has
+  seen and is kept across PortalFlow calls, so the recursion doesn't touch
+  the allocator once it's warmed up.
+  ==================
+*/
+struct flow_arena_t
+{
+    struct frame_t
+    {
+        pstack_t stack{};
+        leafbits_t mightsee;
+    };
+
+    // frames are linked through pstack_t::next, so they must not move
+    std::vector<std::unique_ptr<frame_t>> frames;
+
+    inline pstack_t &frame(size_t depth)
+    {
+        while (frames.size() <= depth) {
+            frames.push_back(std::make_unique<frame_t>());
+        }
+
+        frame_t &f = *frames[depth];
+
+        // contents don't need clearing; every block is written before it's read
+        if (f.mightsee.size() != static_cast<size_t>(portalleafs)) {
+            f.mightsee.resize(portalleafs);
+        }
+
+        pstack_t &stack = f.stack;
+        stack.next = nullptr;
+        stack.leaf = nullptr;
+        stack.portal = nullptr;
+        stack.source = stack.pass = nullptr;
+        std::fill(std::begin(stack.windings_used), std::end(stack.windings_used), false);
+        stack.mightsee = &f.mightsee;
+        stack.numseparators[0] = stack.numseparators[1] = 0;
+        return stack;
+    }
+};
+
+static thread_local flow_arena_t flow_arena;
+
 /*
   ==================
   RecursiveLeafFlow
@@ -142,9 +421,8 @@ static int CheckStack(leaf_t *leaf, threaddata_t *thread)
   If src_portal is NULL, this is the originating leaf
   ==================
 */
-static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevstack)
+static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevstack, size_t depth = 0)
 {
-    pstack_t stack{};
     visportal_t *p;
     qplane3d backplane;
     leaf_t *leaf;
@@ -171,13 +449,11 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         thread->base->numcansee++;
     }
 
+    pstack_t &stack = flow_arena.frame(depth);
     prevstack.next = &stack;
 
     stack.leaf = leaf;
 
-    leafbits_t local(portalleafs);
-    stack.mightsee = &local;
-
     auto might = stack.mightsee->data();
     auto vis = thread->leafvis.data();
 
@@ -244,7 +520,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         if (!prevstack.pass) {
             // the second leaf can only be blocked if coplanar
             stack.source = prevstack.source;
-            RecursiveLeafFlow(p->leaf, thread, stack);
+            RecursiveLeafFlow(p->leaf, thread, stack, depth + 1);
             FreeStackWinding(stack.pass, stack);
             continue;
         }
@@ -321,7 +597,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         c_portalpass++;
 
         // flow through it for real
-        RecursiveLeafFlow(p->leaf, thread, stack);
+        RecursiveLeafFlow(p->leaf, thread, stack, depth + 1);
 
         FreeStackWinding(stack.source, stack);
         FreeStackWinding(stack.pass, stack);
@@ -29,8 +29,15 @@
 #include "common/fs.hh"
 #include <common/log.hh>
 #include <fstream>
+#include <future>
 
-constexpr uint32_t VIS_STATE_VERSION = ('T' << 24 | 'Y' << 16 | 'R' << 8 | '1');
+/*
+ * TYR1 stores the portal bitsets with the byte run-length scheme of
+ * CompressBits. TYR2 uses EncodeWords, which works on whole leafbits_t
+ * words; both can be loaded.
+ */
+constexpr uint32_t VIS_STATE_VERSION_TYR1 = ('T' << 24 | 'Y' << 16 | 'R' << 8 | '1');
+constexpr uint32_t VIS_STATE_VERSION = ('T' << 24 | 'Y' << 16 | 'R' << 8 | '2');
 
 struct dvisstate_t
 {
@@ -131,62 +138,234 @@ static void CopyLeafBits(leafbits_t &dst, const uint8_t *src, size_t numleafs)
     }
 }
 
-void SaveVisState(void)
+/*
+ * Word run-length codec for TYR2 state files. The bitset is a sequence of
+ * tokens, each a varint (count << 2 | kind):
+ *
+ *   kind 0: `count` words of zero
+ *   kind 1: `count` words of all ones
+ *   kind 2: `count` literal words follow, little endian
+ */
+enum : uint32_t
 {
-    int vis_len, might_len;
-    dvisstate_t state;
-    dportal_t pstate;
+    RUN_ZERO = 0,
+    RUN_ONES = 1,
+    RUN_LITERAL = 2
+};
+
+static void WriteVarint(std::vector<uint8_t> &out, size_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static size_t ReadVarint(const uint8_t *&src, const uint8_t *end)
+{
+    size_t value = 0;
+
+    for (size_t shift = 0; shift < sizeof(size_t) * 8; shift += 7) {
+        if (src == end)
+            FError("state file bitset underrun");
+
+        const uint8_t b = *src++;
+        value |= static_cast<size_t>(b & 0x7f) << shift;
+
+        if (!(b & 0x80))
+            return value;
+    }
+
+    FError("state file bitset has a bad varint");
+}
+
+static void EncodeWords(std::vector<uint8_t> &out, const uint32_t *words, size_t count)
+{
+    out.clear();
+
+    for (size_t i = 0; i < count;) {
+        const uint32_t w = words[i];
+        size_t run = 1;
+
+        if (w == 0 || w == 0xffffffff) {
+            while (i + run < count && words[i + run] == w)
+                run++;
+
+            WriteVarint(out, (run << 2) | (w ? RUN_ONES : RUN_ZERO));
+        } else {
+            while (i + run < count && words[i + run] != 0 && words[i + run] != 0xffffffff)
+                run++;
 
+            WriteVarint(out, (run << 2) | RUN_LITERAL);
+
+            for (size_t j = i; j < i + run; j++) {
+                for (size_t b = 0; b < sizeof(uint32_t); b++) {
+                    out.push_back(static_cast<uint8_t>(words[j] >> (b * 8)));
+                }
+            }
+        }
+
+        i += run;
+    }
+}
+
+static void DecodeWords(leafbits_t &dst, const uint8_t *src, size_t len)
+{
+    const uint8_t *end = src + len;
+    const size_t count = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+
+    dst.resize(portalleafs);
+    uint32_t *words = dst.data();
+
+    for (size_t i = 0; i < count;) {
+        const size_t token = ReadVarint(src, end);
+        const size_t run = token >> 2;
+
+        if (!run || run > count - i)
+            FError("state file bitset overflow");
+
+        switch (token & 3) {
+            case RUN_ZERO: break;
+            case RUN_ONES: std::fill_n(words + i, run, 0xffffffff); break;
+            case RUN_LITERAL:
+                if (static_cast<size_t>(end - src) < run * sizeof(uint32_t))
+                    FError("state file bitset underrun");
+
+                for (size_t j = i; j < i + run; j++) {
+                    words[j] = src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+                    src += sizeof(uint32_t);
+                }
+                break;
+            default: FError("state file bitset has a bad token");
+        }
+
+        i += run;
+    }
+}
+
+/*
+ * A copy of the state taken under portal_mutex; encoding and writing it
+ * happens on a background thread while vis carries on.
+ */
+struct visstate_snapshot_t
+{
+    struct portal_t
+    {
+        uint32_t status, nummightsee, numcansee;
+        std::vector<uint32_t> mightsee, visbits;
+    };
+
+    dvisstate_t header;
+    size_t numwords;
+    std::vector<portal_t> portals;
+};
+
+static std::future<void> pending_state_write;
+
+static void WriteVisState(const visstate_snapshot_t &snapshot)
+{
     std::ofstream out(statetmpfile, std::ios_base::out | std::ios_base::binary);
     out << endianness<std::endian::little>;
 
-    /* Write out a header */
-    state.version = VIS_STATE_VERSION;
-    state.numportals = numportals;
-    state.numleafs = portalleafs;
-    state.testlevel = vis_options.visdist.value();
-    state.time_elapsed = (uint32_t)(statetime - starttime).count();
-
-    out <= state;
+    out <= snapshot.header;
 
-    /* Allocate memory for compressed bitstrings */
-    std::vector<uint8_t> might((portalleafs + 7) >> 3);
-    std::vector<uint8_t> vis((portalleafs + 7) >> 3);
+    std::vector<uint8_t> might, vis;
 
-    for (const auto &p : portals) {
-        might_len = CompressBits(might.data(), p.mightsee);
+    for (const auto &p : snapshot.portals) {
+        EncodeWords(might, p.mightsee.data(), snapshot.numwords);
         if (p.status == pstat_done) {
-            vis_len = CompressBits(vis.data(), p.visbits);
+            EncodeWords(vis, p.visbits.data(), snapshot.numwords);
         } else {
-            vis_len = 0;
+            vis.clear();
         }
 
+        dportal_t pstate;
         pstate.status = p.status;
-        pstate.might = might_len;
-        pstate.vis = vis_len;
+        pstate.might = might.size();
+        pstate.vis = vis.size();
         pstate.nummightsee = p.nummightsee;
         pstate.numcansee = p.numcansee;
 
         out <= pstate;
-        out.write((const char *)might.data(), might_len);
-        if (vis_len) {
-            out.write((const char *)vis.data(), vis_len);
-        }
+        out.write((const char *)might.data(), might.size());
+        out.write((const char *)vis.data(), vis.size());
     }
 
     out.close();
 
-    std::error_code ec;
-
-    fs::remove(statefile, ec);
-    if (ec && ec.value() != ENOENT)
-        FError("error removing old state ({})", ec.message());
+    if (!out)
+        FError("error writing state file {}", statetmpfile);
 
+    // replaces the old state in one step, so a crash leaves either one intact
+    std::error_code ec;
     fs::rename(statetmpfile, statefile, ec);
     if (ec)
         FError("error renaming state file ({})", ec.message());
 }
 
+/*
+  ==============
+  SaveVisState
+
+  Snapshots the portal state and writes it out on a background thread. If
+  the previous write is still going, this checkpoint is skipped.
+
+  Called with portal_mutex held (or with no vis threads running).
+  ==============
+*/
+void SaveVisState(void)
+{
+    if (pending_state_write.valid()) {
+        if (pending_state_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+
+        // rethrows any error from the previous write
+        pending_state_write.get();
+    }
+
+    auto snapshot = std::make_shared<visstate_snapshot_t>();
+
+    /* Write out a header */
+    snapshot->header.version = VIS_STATE_VERSION;
+    snapshot->header.numportals = numportals;
+    snapshot->header.numleafs = portalleafs;
+    snapshot->header.testlevel = vis_options.visdist.value();
+    snapshot->header.time_elapsed = (uint32_t)(statetime - starttime).count();
+    snapshot->numwords = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+    snapshot->portals.resize(portals.size());
+
+    for (size_t i = 0; i < portals.size(); i++) {
+        const auto &p = portals[i];
+        auto &sp = snapshot->portals[i];
+
+        sp.status = p.status;
+        sp.nummightsee = p.nummightsee;
+        sp.numcansee = p.numcansee;
+        sp.mightsee.assign(p.mightsee.data(), p.mightsee.data() + snapshot->numwords);
+        if (p.status == pstat_done) {
+            sp.visbits.assign(p.visbits.data(), p.visbits.data() + snapshot->numwords);
+        }
+    }
+
+    pending_state_write = std::async(std::launch::async, [snapshot]() { WriteVisState(*snapshot); });
+}
+
+/*
+  ==============
+  WaitVisState
+
+  Blocks until the last SaveVisState has been written.
+  ==============
+*/
+void WaitVisState(void)
+{
+    if (pending_state_write.valid()) {
+        pending_state_write.get();
+    }
+}
+
 void CleanVisState(void)
 {
     if (fs::exists(statefile)) {
@@ -220,6 +399,12 @@ bool LoadVisState(void)
         state_time = fs::last_write_time(statefile);
     }
 
+    // e.g. the portals were handed over in memory (qbsp -memoryprt)
+    if (!fs::exists(portalfile)) {
+        logging::print("No portal file to check the state file against, will be overwritten\n");
+        return false;
+    }
+
     prt_time = fs::last_write_time(portalfile);
     if (prt_time > state_time) {
         logging::print("State file is out of date, will be overwritten\n");
@@ -232,7 +417,7 @@ bool LoadVisState(void)
     in >= state;
 
     /* Sanity check the headers */
-    if (state.version != VIS_STATE_VERSION) {
+    if (state.version != VIS_STATE_VERSION && state.version != VIS_STATE_VERSION_TYR1) {
         FError("state file version does not match");
     }
     if (state.numportals != numportals || state.numleafs != portalleafs) {
@@ -253,6 +438,31 @@ bool LoadVisState(void)
         p.nummightsee = pstate.nummightsee;
         p.numcansee = pstate.numcansee;
 
+        if (state.version == VIS_STATE_VERSION) {
+            compressed.resize(std::max(pstate.might, pstate.vis));
+
+            in.read((char *)compressed.data(), pstate.might);
+            DecodeWords(p.mightsee, compressed.data(), pstate.might);
+
+            p.visbits.resize(portalleafs);
+
+            if (pstate.vis) {
+                in.read((char *)compressed.data(), pstate.vis);
+                DecodeWords(p.visbits, compressed.data(), pstate.vis);
+            }
+
+            if (!in)
+                FError("unexpected end of state file {}", statefile);
+
+            /* Portals that were in progress need to be started again */
+            if (p.status == pstat_working) {
+                p.status = pstat_none;
+            }
+            continue;
+        }
+
+        compressed.resize(numbytes);
+
         in.read((char *)compressed.data(), pstate.might);
         p.mightsee.resize(portalleafs);
 
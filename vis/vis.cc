@@ -131,9 +131,9 @@ void FreeStackWinding(viswinding_t *&w, pstack_t &stack)
 viswinding_t *ClipStackWinding(viswinding_t *in, pstack_t &stack, const qplane3d &split)
 {
     vec_t *dists = (vec_t *)alloca(sizeof(vec_t) * (in->size() + 1));
-    int *sides = (int *)alloca(sizeof(int) * (in->size() + 1));
-    int counts[3];
-    int i, j;
+    planeside_t *sides = (planeside_t *)alloca(sizeof(planeside_t) * (in->size() + 1));
+    size_t i;
+    int j;
 
     /* Fast test first */
     vec_t dot = split.distance_to(in->origin);
@@ -147,23 +147,8 @@ viswinding_t *ClipStackWinding(viswinding_t *in, pstack_t &stack, const qplane3d
     if (in->size() > MAX_WINDING)
         FError("in->numpoints > MAX_WINDING ({} > {})", in->size(), MAX_WINDING);
 
-    counts[0] = counts[1] = counts[2] = 0;
-
-    /* determine sides for each point */
-    for (i = 0; i < in->size(); i++) {
-        dot = split.distance_to((*in)[i]);
-        dists[i] = dot;
-        if (dot > VIS_ON_EPSILON)
-            sides[i] = SIDE_FRONT;
-        else if (dot < -VIS_ON_EPSILON)
-            sides[i] = SIDE_BACK;
-        else {
-            sides[i] = SIDE_ON;
-        }
-        counts[sides[i]]++;
-    }
-    sides[i] = sides[0];
-    dists[i] = dists[0];
+    /* determine sides for each point, in one pass */
+    const std::array<size_t, SIDE_TOTAL> counts = in->calc_sides(split, dists, sides, VIS_ON_EPSILON);
 
     // ericw -- coplanar portals: return without clipping. Otherwise when two portals are less than ON_EPSILON apart,
     // one will get fully clipped away and we can't see through it causing
@@ -172,11 +157,11 @@ viswinding_t *ClipStackWinding(viswinding_t *in, pstack_t &stack, const qplane3d
         return in;
     }
 
-    if (!counts[0]) {
+    if (!counts[SIDE_FRONT]) {
         FreeStackWinding(in, stack);
         return nullptr;
     }
-    if (!counts[1])
+    if (!counts[SIDE_BACK])
         return in;
 
     auto neww = AllocStackWinding(stack);
@@ -536,9 +521,13 @@ void CalcPortalVis(const mbsp_t *bsp)
     }
 
     portalIndex = startcount;
+    ResetSeparatorCache();
     logging::parallel_for(startcount, numportals * 2, LeafThread);
 
+    // the final state replaces any checkpoint still being written
+    WaitVisState();
     SaveVisState();
+    WaitVisState();
 
     logging::print(logging::flag::VERBOSE, "portalcheck: {}  portaltest: {}  portalpass: {}\n", c_portalcheck,
         c_portaltest, c_portalpass);
@@ -591,8 +580,192 @@ void CalcVis(mbsp_t *bsp)
 // ===========================================================================
 
 #include <fstream>
+#include <map>
+#include <numeric>
 #include <common/prtfile.hh>
 
+/*
+  ============
+  MergeSmallClusters
+
+  Merges each cluster whose bounds are smaller than `max_volume` into the
+  neighbouring cluster it shares the most portal area with, as long as the
+  merged cluster ends up with at most `max_portals` portals, and drops the
+  portals inside the merged clusters. The tiny leafs qbsp leaves around
+  detail are the usual candidates; taking them out of the portal graph
+  makes PortalFlow a lot cheaper. This is the same as qbsp writing those
+  leafs as one PRT2 cluster, so vis only gets looser within a merged
+  cluster.
+
+  Q1 only; `dleafs` are the bsp leafs, for the bounds. Returns the number
+  of clusters removed.
+  ============
+*/
+int MergeSmallClusters(prtfile_t &prtfile, const std::vector<mleaf_t> &dleafs, vec_t max_volume, size_t max_portals)
+{
+    struct neighbour_t
+    {
+        size_t numportals = 0;
+        vec_t area = 0;
+    };
+
+    const size_t numclusters = prtfile.portalleafs;
+    std::vector<aabb3d> bounds(numclusters);
+    std::vector<bool> has_bounds(numclusters);
+
+    for (size_t i = 1; i < prtfile.dleafinfos.size() && i < dleafs.size(); i++) {
+        const size_t cluster = prtfile.dleafinfos[i].cluster;
+
+        if (cluster < numclusters) {
+            bounds[cluster] += aabb3d(dleafs[i].mins, dleafs[i].maxs);
+            has_bounds[cluster] = true;
+        }
+    }
+
+    // ordered maps, so the merges don't depend on hash order
+    std::vector<std::map<size_t, neighbour_t>> neighbours(numclusters);
+    std::vector<size_t> numportals(numclusters);
+
+    for (auto &portal : prtfile.portals) {
+        const size_t a = portal.leafnums[0], b = portal.leafnums[1];
+        const vec_t area = portal.winding.area();
+
+        numportals[a]++;
+        numportals[b]++;
+
+        if (a != b) {
+            auto &ab = neighbours[a][b], &ba = neighbours[b][a];
+            ab.numportals++;
+            ab.area += area;
+            ba.numportals++;
+            ba.area += area;
+        }
+    }
+
+    std::vector<size_t> parent(numclusters);
+    std::iota(parent.begin(), parent.end(), 0);
+
+    auto find = [&](size_t c) {
+        while (parent[c] != c) {
+            c = parent[c] = parent[parent[c]];
+        }
+        return c;
+    };
+
+    auto is_small = [&](size_t c) { return has_bounds[c] && bounds[c].volume() < max_volume; };
+
+    // smallest clusters first
+    std::vector<size_t> order;
+    for (size_t c = 0; c < numclusters; c++) {
+        if (is_small(c)) {
+            order.push_back(c);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&](size_t a, size_t b) { return bounds[a].volume() < bounds[b].volume(); });
+
+    int merged = 0;
+
+    for (size_t c : order) {
+        const size_t from = find(c);
+
+        if (!is_small(from)) {
+            continue;
+        }
+
+        std::optional<size_t> into;
+        vec_t best_area = -1;
+
+        for (auto &[other, shared] : neighbours[from]) {
+            if (numportals[from] + numportals[other] - 2 * shared.numportals > max_portals) {
+                continue;
+            }
+            if (!has_bounds[other]) {
+                continue;
+            }
+            if (shared.area > best_area) {
+                best_area = shared.area;
+                into = other;
+            }
+        }
+
+        if (!into) {
+            continue;
+        }
+
+        const size_t to = *into;
+
+        numportals[to] += numportals[from] - 2 * neighbours[from][to].numportals;
+        bounds[to] += bounds[from];
+
+        for (auto &[other, shared] : neighbours[from]) {
+            if (other == to) {
+                continue;
+            }
+
+            auto &to_other = neighbours[to][other];
+            to_other.numportals += shared.numportals;
+            to_other.area += shared.area;
+
+            auto &other_from = neighbours[other];
+            auto &other_to = other_from[to];
+            other_to.numportals += shared.numportals;
+            other_to.area += shared.area;
+            other_from.erase(from);
+        }
+
+        neighbours[to].erase(from);
+        neighbours[from].clear();
+        parent[from] = to;
+        merged++;
+    }
+
+    if (!merged) {
+        return 0;
+    }
+
+    // renumber, keeping the clusters in the order of their first member
+    std::vector<int> renumber(numclusters, -1);
+    int newcount = 0;
+
+    for (size_t c = 0; c < numclusters; c++) {
+        const size_t root = find(c);
+
+        if (renumber[root] == -1) {
+            renumber[root] = newcount++;
+        }
+    }
+
+    std::vector<prtfile_portal_t> portals;
+    portals.reserve(prtfile.portals.size());
+
+    for (auto &portal : prtfile.portals) {
+        const int a = renumber[find(portal.leafnums[0])], b = renumber[find(portal.leafnums[1])];
+
+        if (a == b) {
+            continue; // inside a merged cluster
+        }
+
+        portal.leafnums[0] = a;
+        portal.leafnums[1] = b;
+        portals.push_back(std::move(portal));
+    }
+
+    prtfile.portals = std::move(portals);
+
+    for (size_t i = 1; i < prtfile.dleafinfos.size(); i++) {
+        auto &cluster = prtfile.dleafinfos[i].cluster;
+
+        if (cluster >= 0 && static_cast<size_t>(cluster) < numclusters) {
+            cluster = renumber[find(cluster)];
+        }
+    }
+
+    prtfile.portalleafs = newcount;
+
+    return merged;
+}
+
 /*
   ============
   LoadPortals
@@ -600,7 +773,13 @@ void CalcVis(mbsp_t *bsp)
 */
 static void LoadPortals(const fs::path &name, mbsp_t *bsp)
 {
-    const prtfile_t prtfile = LoadPrtFile(name, bsp->loadversion);
+    prtfile_t prtfile = LoadPrtFile(name, bsp->loadversion);
+
+    if (bsp->loadversion->game->id != GAME_QUAKE_II && vis_options.mergevolume.value() > 0) {
+        const int merged = MergeSmallClusters(
+            prtfile, bsp->dleafs, vis_options.mergevolume.value(), vis_options.mergeportals.value());
+        logging::print("{:6} small clusters merged\n", merged);
+    }
 
     portalleafs = prtfile.portalleafs;
     portalleafs_real = prtfile.portalleafs_real;
@@ -763,6 +942,7 @@ int vis_main(int argc, const char **argv)
 
         logging::print("c_noclip: {}\n", c_noclip);
         logging::print("c_chains: {}\n", c_chains);
+        PrintSeparatorCacheStats();
 
         bsp.dvis.bits = std::move(vismap);
         bsp.dvis.bits.shrink_to_fit();